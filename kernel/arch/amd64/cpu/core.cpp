@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -59,6 +59,7 @@ void core::reinit_as(const core & other)
     _id = other._id;
     _apic_id = other._apic_id;
     _acpi_id = other._acpi_id;
+    _proximity_domain = other._proximity_domain;
 
     _nmi_vector = other._nmi_vector;
     _nmi_flags = other._nmi_flags;
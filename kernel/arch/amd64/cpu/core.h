@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -18,8 +18,11 @@
 
 #include "gdt.h"
 
+#include "../../../memory/pmm.h"
+#include "../../../memory/vm.h"
 #include "../../../scheduler/types.h"
 #include "../../../util/mp.h"
+#include "../memory/vm.h"
 #include "../timers/lapic.h"
 
 #include <cstddef>
@@ -71,6 +74,11 @@ public:
         _nmi_flags = flags;
     }
 
+    void set_proximity_domain(std::uint32_t domain)
+    {
+        _proximity_domain = domain;
+    }
+
     auto id()
     {
         return _id;
@@ -86,6 +94,11 @@ public:
         return _acpi_id;
     }
 
+    auto proximity_domain()
+    {
+        return _proximity_domain;
+    }
+
     lapic_timer::timer * get_timer()
     {
         return &_preempt_timer;
@@ -96,11 +109,26 @@ public:
         return &_local_scheduler;
     }
 
+    pmm::frame_cache * get_frame_cache()
+    {
+        return &_frame_cache;
+    }
+
     kernel::mp::ipi_queue * get_ipi_queue()
     {
         return &_ipi_queue;
     }
 
+    vm::pcid_cache * get_pcid_cache()
+    {
+        return &_pcid_cache;
+    }
+
+    kernel::vm::address_cache * get_address_cache()
+    {
+        return &_address_cache;
+    }
+
     core_local_storage * get_core_local_storage()
     {
         return &_cls;
@@ -129,6 +157,7 @@ private:
     std::uint32_t _id = -1;
     std::uint32_t _apic_id = 0;
     std::uint32_t _acpi_id = 0;
+    std::uint32_t _proximity_domain = 0;
 
     std::uint32_t _nmi_vector = 0;
     std::uint16_t _nmi_flags = 0;
@@ -143,7 +172,10 @@ private:
 
     lapic_timer::timer _preempt_timer;
     scheduler::instance _local_scheduler;
+    pmm::frame_cache _frame_cache;
     kernel::mp::ipi_queue _ipi_queue;
+    vm::pcid_cache _pcid_cache;
+    kernel::vm::address_cache _address_cache;
 
     core_local_storage _cls;
     core_local_storage * _cls_ptr;
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -15,6 +15,7 @@
  */
 
 #include "cpu.h"
+#include "../../../memory/pmm.h"
 #include "../../../memory/vm.h"
 #include "../../../scheduler/scheduler.h"
 #include "../../../scheduler/thread.h"
@@ -24,6 +25,7 @@
 #include "gdt.h"
 #include "idt.h"
 #include "int.h"
+#include "irqs.h"
 #include "lapic.h"
 #include "syscalls.h"
 
@@ -40,12 +42,89 @@ namespace
 
     constexpr auto ia32_gs_base = 0xc0000101;
     constexpr auto ia32_kernel_gs_base = 0xc0000102;
+    constexpr auto ia32_pat = 0x277;
 
     void initialize_local_storage(core * self)
     {
         wrmsr(ia32_gs_base, reinterpret_cast<std::uint64_t>(self->get_core_local_storage_ptr()));
         wrmsr(ia32_kernel_gs_base, reinterpret_cast<std::uint64_t>(self->get_core_local_storage_ptr()));
     }
+
+    // Makes the kernel respect read-only pages too, so that its writes to user memory that is shared
+    // copy-on-write fault like the writes of userspace do.
+    void enable_write_protection()
+    {
+        std::uint64_t cr0;
+        asm volatile("mov %%cr0, %0" : "=r"(cr0));
+        cr0 |= 1 << 16;
+        asm volatile("mov %0, %%cr0" ::"r"(cr0) : "memory");
+    }
+
+    // Tags TLB entries with the address space they belong to, so that switching between address spaces
+    // doesn't have to flush them all; see vm::set_asid. Left disabled on cores that don't support it.
+    void enable_pcids(core * self)
+    {
+        std::uint32_t eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+
+        if (!(ecx & (1 << 17)))
+        {
+            return;
+        }
+
+        // PCIDs can only be enabled while the low bits of CR3 are clear
+        vm::set_asid(vm::get_asid());
+
+        std::uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= 1 << 17;
+        asm volatile("mov %0, %%cr4" ::"r"(cr4) : "memory");
+
+        self->get_pcid_cache()->enable();
+    }
+
+    bool has_rdrand = false;
+
+    void detect_rdrand()
+    {
+        std::uint32_t eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+
+        has_rdrand = ecx & (1 << 30);
+    }
+
+    void detect_huge_pages()
+    {
+        std::uint32_t eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001), "c"(0));
+
+        if (edx & (1 << 26))
+        {
+            vm::enable_huge_pages();
+        }
+    }
+
+    // Keeps the power-on layout of the PAT, except for index 4, which becomes write-combining instead of
+    // another write-back entry; the page tables select the entries accordingly. All cores must agree on this.
+    void program_pat()
+    {
+        constexpr std::uint64_t write_back = 0x06;
+        constexpr std::uint64_t write_through = 0x04;
+        constexpr std::uint64_t uncached_minus = 0x07;
+        constexpr std::uint64_t uncacheable = 0x00;
+        constexpr std::uint64_t write_combining = 0x01;
+
+        constexpr std::uint64_t entries[] = { write_back,      write_through,  uncached_minus, uncacheable,
+                                              write_combining, write_through,  uncached_minus, uncacheable };
+
+        std::uint64_t pat = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            pat |= entries[i] << (i * 8);
+        }
+
+        wrmsr(ia32_pat, pat);
+    }
 }
 
 namespace detail_for_mp
@@ -67,6 +146,7 @@ void initialize()
 
     auto madt_result = acpi::parse_madt(cores, core_count);
     core_count = madt_result.core_count;
+    acpi::parse_srat_cores(cores, core_count);
 
     lapic::initialize(madt_result.lapic_base);
 
@@ -76,8 +156,14 @@ void initialize()
 
     idt::initialize();
     idt::load();
+    irq::initialize();
 
+    enable_write_protection();
+    program_pat();
     initialize_local_storage(bsp_core);
+    enable_pcids(bsp_core);
+    detect_huge_pages();
+    detect_rdrand();
     syscalls::initialize();
 }
 
@@ -87,7 +173,11 @@ void idle()
 
     while (true)
     {
-        asm volatile("hlt");
+        // only halt once there is no background work left to do
+        if (!pmm::zero_free_frames())
+        {
+            asm volatile("hlt");
+        }
     }
 }
 
@@ -100,7 +190,10 @@ void ap_initialize()
     core->load_gdt();
     idt::load();
 
+    enable_write_protection();
+    program_pat();
     initialize_local_storage(core);
+    enable_pcids(core);
     syscalls::initialize();
 
     lapic_timer::ap_initialize();
@@ -176,4 +269,29 @@ std::size_t get_core_count()
 {
     return core_count;
 }
+
+std::uint64_t get_random()
+{
+    if (has_rdrand)
+    {
+        // RDRAND can fail transiently when it runs out of entropy; 10 retries are what Intel recommends
+        for (int i = 0; i < 10; ++i)
+        {
+            std::uint64_t value;
+            bool success;
+            asm volatile("rdrand %0" : "=r"(value), "=@ccc"(success));
+
+            if (success)
+            {
+                return value;
+            }
+        }
+    }
+
+    // splitmix64 of the timestamp counter; easy to predict, but still better than a fixed value
+    auto value = get_timestamp_counter() + 0x9e3779b97f4a7c15;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -45,6 +45,14 @@ inline void wrmsr(std::uint32_t msr, std::uint64_t val)
     wrmsr(msr, val & 0xFFFFFFFF, val >> 32);
 }
 
+inline std::uint64_t get_timestamp_counter()
+{
+    std::uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<std::uint64_t>(high) << 32) | low;
+}
+
 namespace detail_for_mp
 {
     core * get_core_array();
@@ -60,4 +68,7 @@ core * get_current_core();
 core * get_core_by_apic_id(std::uint32_t id);
 core * get_core_by_id(std::size_t id);
 std::size_t get_core_count();
+
+// Not suitable for cryptography: without RDRAND, this is only derived from the timestamp counter.
+std::uint64_t get_random();
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -114,10 +114,12 @@ namespace
         setup_idte(8, &isr<8>, 0x8, true, 0, 0xf, idt, 2);
     }
 
+    // page faults are a part of normal operation, since sparse VMOs are committed on demand; they are handled
+    // like other interrupts, on the stack of the faulting thread, with interrupts disabled
     template<>
     void setup_isr<14>()
     {
-        setup_idte(14, &isr<14>, 0x8, true, 0, 0xf, idt, 3);
+        setup_idte(14, &isr<14>, 0x8, true, 0, 0xe, idt);
     }
 
     template<std::size_t... Is>
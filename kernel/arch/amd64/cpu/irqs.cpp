@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,6 +16,8 @@
 
 #include "irqs.h"
 
+#include "../../../memory/vas.h"
+#include "../../../scheduler/scheduler.h"
 #include "../../../scheduler/thread.h"
 #include "../../../util/interrupt_control.h"
 #include "../../../util/log.h"
@@ -100,6 +102,49 @@ namespace
     };
 
     irq_handler irq_handlers[256];
+
+    constexpr std::uint8_t page_fault = 14;
+
+    void page_fault_handler(context & ctx)
+    {
+        std::uintptr_t address;
+        asm volatile("mov %%cr2, %0" : "=r"(address));
+
+        constexpr std::uint64_t present_bit = 1 << 0;
+        constexpr std::uint64_t write_bit = 1 << 1;
+        constexpr std::uint64_t user_bit = 1 << 2;
+
+        // faults on pages that are not present are where sparse VMOs get committed and mapped on demand, and
+        // writes to present pages are where pages mapped to the zero frame, or to frames shared by VMO
+        // clones, get frames of their own; anything else (and anything before there are threads and address
+        // spaces) is a genuine error; only faults raised by userspace can be parked waiting for a pager, as
+        // the kernel can't be descheduled in the middle of whatever it was doing
+        auto present = ctx.error & present_bit;
+        auto write = ctx.error & write_bit;
+        auto user = ctx.error & user_bit;
+        auto kernel_address = address >= 0x8000000000000000;
+
+        // userspace has no business with the kernel half; it must not get to commit pages of kernel VMOs, or
+        // wait on them
+        if ((!present || write) && !(user && kernel_address) && scheduler::is_initialized())
+        {
+            auto vas = kernel_address
+                ? scheduler::get_kernel_process()->get_vas()
+                : cpu::get_core_local_storage()->current_thread->get_container()->get_vas();
+
+            if (vas->handle_page_fault(virt_addr_t(address), write, user))
+            {
+                return;
+            }
+        }
+
+        PANIC("Unhandled page fault at {:#018x}, error: {:b}, @ {:#018x}", address, ctx.error, ctx.rip);
+    }
+}
+
+void initialize()
+{
+    register_handler(page_fault, &page_fault_handler);
 }
 
 extern "C" void interrupt_handler(context ctx)
@@ -116,6 +161,12 @@ extern "C" void interrupt_handler(context ctx)
     util::intrusive_ptr<scheduler::thread> previous_thread;
     util::intrusive_ptr<scheduler::thread> new_thread;
 
+    // the handler is only read under the lock, not called with it held; handlers can take a while (page
+    // faults can wait for TLB shootdowns), and the same vector can be raised on other cores in the meantime
+    erased_irq_handler fptr;
+    void * erased_fptr;
+    std::uint64_t context;
+
     {
         std::lock_guard lg(handler.lock);
 
@@ -124,11 +175,15 @@ extern "C" void interrupt_handler(context ctx)
             PANIC("Unexpected IRQ: {:#04x}, {:b}, @ {:#018x}", ctx.number, ctx.error, ctx.rip);
         }
 
-        previous_thread = cpu::get_core_local_storage()->current_thread;
-        handler.fptr(ctx, handler.erased_fptr, handler.context);
-        new_thread = cpu::get_core_local_storage()->current_thread;
+        fptr = handler.fptr;
+        erased_fptr = handler.erased_fptr;
+        context = handler.context;
     }
 
+    previous_thread = cpu::get_core_local_storage()->current_thread;
+    fptr(ctx, erased_fptr, context);
+    new_thread = cpu::get_core_local_storage()->current_thread;
+
     if (new_thread != previous_thread)
     {
         ctx.save_to(previous_thread->get_context());
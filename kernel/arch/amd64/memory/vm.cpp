@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -27,6 +27,70 @@
 
 namespace kernel::amd64::vm
 {
+namespace
+{
+    // with PCIDs enabled, the low bits of CR3 hold the PCID, and setting the top bit when loading it keeps
+    // the TLB entries tagged with that PCID
+    constexpr std::uint64_t cr3_pcid_mask = 0xfff;
+    constexpr std::uint64_t cr3_no_flush = 1ull << 63;
+}
+
+pcid_cache::assignment pcid_cache::assign(phys_addr_t asid, std::uint64_t generation)
+{
+    ++_clock;
+
+    std::size_t victim = 0;
+    for (std::size_t i = 0; i < _slot_count; ++i)
+    {
+        auto & slot = _slots[i];
+
+        if (slot.assigned && slot.asid == asid)
+        {
+            auto keep_entries = slot.keep_entries && slot.generation == generation;
+            slot.keep_entries = true;
+            slot.generation = generation;
+            slot.last_used = _clock;
+
+            return { static_cast<std::uint16_t>(i + 1), keep_entries };
+        }
+
+        if (slot.last_used < _slots[victim].last_used)
+        {
+            victim = i;
+        }
+    }
+
+    _slots[victim] = {
+        .asid = asid, .assigned = true, .keep_entries = true, .generation = generation, .last_used = _clock
+    };
+    return { static_cast<std::uint16_t>(victim + 1), false };
+}
+
+void pcid_cache::forget(phys_addr_t asid)
+{
+    for (auto & slot : _slots)
+    {
+        if (slot.assigned && slot.asid == asid)
+        {
+            slot.assigned = false;
+            slot.keep_entries = false;
+            slot.last_used = 0;
+            return;
+        }
+    }
+}
+
+void pcid_cache::invalidate_others(phys_addr_t current)
+{
+    for (auto & slot : _slots)
+    {
+        if (slot.asid != current)
+        {
+            slot.keep_entries = false;
+        }
+    }
+}
+
 void set_asid(phys_addr_t asid)
 {
     asm volatile("mov %0, %%cr3" ::"r"(asid.value()) : "memory");
@@ -36,7 +100,36 @@ phys_addr_t get_asid()
 {
     std::uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    return phys_addr_t(cr3);
+    return phys_addr_t(cr3 & ~cr3_pcid_mask);
+}
+
+void switch_address_space(kernel::vm::vas * from, kernel::vm::vas * to)
+{
+    auto core = cpu::get_current_core();
+    auto & state = to->get_tlb_state();
+
+    // the core is marked before the generation is read, and shootdowns bump the generation before reading
+    // the mask, so a shootdown running concurrently with this either interrupts this core, or is seen here
+    state.loaded_on.set(core->id());
+    auto generation = state.generation.load();
+
+    auto pcids = core->get_pcid_cache();
+    if (!pcids->is_enabled())
+    {
+        set_asid(to->get_asid());
+    }
+
+    else
+    {
+        auto assignment = pcids->assign(to->get_asid(), generation);
+        auto cr3 = to->get_asid().value() | assignment.pcid | (assignment.keep_entries ? cr3_no_flush : 0);
+        asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+    }
+
+    if (from)
+    {
+        from->get_tlb_state().loaded_on.clear(core->id());
+    }
 }
 
 namespace
@@ -54,12 +147,17 @@ namespace
 
         phys_addr_t get_phys() const
         {
-            return phys_addr_t(address << 12);
+            // in large pages, the lowest bit of the address field is the PAT bit
+            return phys_addr_t((size ? address & ~1ull : address) << 12);
         }
 
         void operator=(pmlt<I - 1> * phys)
         {
+            // the entry may have been a large page before, with different attributes
             present = 1;
+            size = 0;
+            write_through = 0;
+            cache_disable = 0;
             address = phys_ptr_t(phys).representation().value() >> 12;
         }
 
@@ -134,10 +232,33 @@ namespace
 
     using pml4_t = pmlt<4>;
 
+    // Selects the entry of the PAT that cpu::initialize programs for the caching mode: WB, WT and UC are at
+    // the indices they have by default (0, 1 and 3), and WC replaces the duplicate of WB at index 4.
+    template<int I>
+    void set_caching_mode(pmle<I> & entry, kernel::vm::flags flags)
+    {
+        auto mode = kernel::vm::caching_mode(flags);
+        entry.write_through =
+            mode == kernel::vm::flags::write_through || mode == kernel::vm::flags::uncacheable;
+        entry.cache_disable = mode == kernel::vm::flags::uncacheable;
+
+        std::uint64_t pat = mode == kernel::vm::flags::write_combining;
+        if constexpr (I == 1)
+        {
+            entry.pat = pat;
+        }
+        else
+        {
+            entry.address = (entry.address & ~1ull) | pat;
+        }
+    }
+
     class tlb_invalidator
     {
     public:
-        tlb_invalidator(std::optional<phys_addr_t> asid) : _asid(asid)
+        // `address_space` is null for kernel ranges, which are shared by all address spaces, and when the
+        // current address space is used without naming it; both are shot down on all cores
+        tlb_invalidator(kernel::vm::vas * address_space) : _address_space(address_space)
         {
         }
 
@@ -155,13 +276,42 @@ namespace
             }
         }
 
+        // frames queued here are returned to the PMM in a single batch, once the pages that mapped them
+        // have been invalidated
+        void free_frame(phys_addr_t frame)
+        {
+            _frames[_num_frames++] = frame;
+            if (_num_frames == 32)
+            {
+                _trigger();
+            }
+        }
+
+        void free_large_frame(phys_addr_t frame)
+        {
+            _large_frames[_num_large_frames++] = frame;
+            if (_num_large_frames == 32)
+            {
+                _trigger();
+            }
+        }
+
     private:
-        std::optional<phys_addr_t> _asid;
+        kernel::vm::vas * _address_space;
         std::size_t _num_pages = 0;
         virt_addr_t _pages[32];
+        std::size_t _num_frames = 0;
+        phys_addr_t _frames[32];
+        std::size_t _num_large_frames = 0;
+        phys_addr_t _large_frames[32];
 
         void _trigger()
         {
+            if (_num_pages == 0 && _num_frames == 0 && _num_large_frames == 0)
+            {
+                return;
+            }
+
             if (!scheduler::is_initialized()) [[unlikely]]
             {
                 for (std::size_t i = 0; i < _num_pages; ++i)
@@ -170,13 +320,18 @@ namespace
                 }
             }
 
-            else
+            else if (_address_space)
             {
+                auto & state = _address_space->get_tlb_state();
+                state.generation.fetch_add(1);
+
                 kernel::mp::parallel_execute(
-                    kernel::mp::policy::all,
+                    kernel::mp::policy::mask,
                     +[](tlb_invalidator * self)
                     {
-                        if (self->_asid && self->_asid != get_asid())
+                        // the core may have switched away since it was found in the mask; it'll notice the
+                        // new generation when it switches back
+                        if (self->_address_space->get_asid() != get_asid())
                         {
                             return;
                         }
@@ -186,15 +341,83 @@ namespace
                             asm volatile("invlpg (%0)" ::"r"(self->_pages[i].value()) : "memory");
                         }
                     },
+                    this,
+                    reinterpret_cast<std::uintptr_t>(&state.loaded_on));
+            }
+
+            else
+            {
+                kernel::mp::parallel_execute(
+                    kernel::mp::policy::all,
+                    +[](tlb_invalidator * self)
+                    {
+                        // invlpg only reaches the entries of the current PCID, but kernel mappings are cached
+                        // under all of them
+                        cpu::get_current_core()->get_pcid_cache()->invalidate_others(get_asid());
+
+                        for (std::size_t i = 0; i < self->_num_pages; ++i)
+                        {
+                            asm volatile("invlpg (%0)" ::"r"(self->_pages[i].value()) : "memory");
+                        }
+                    },
                     this);
             }
 
             _num_pages = 0;
+
+            pmm::push_n(0, _frames, _num_frames);
+            _num_frames = 0;
+
+            pmm::push_n(1, _large_frames, _num_large_frames);
+            _num_large_frames = 0;
         }
     };
 
+    bool huge_pages_allowed = false;
+
+    // Replaces a large page with a table of pages of the next smaller size that map the same memory with the
+    // same attributes, so that a part of it can be changed. The entry must be locked.
+    template<int I>
+    void split_large_page(pmle<I> & entry)
+    {
+        constexpr auto subentry_size = 1ull << ((I - 1) * 9 + 3);
+
+        auto base = entry.get_phys().value();
+        std::uint64_t pat = entry.address & 1;
+
+        auto table = new pmlt<I - 1>{};
+        for (std::size_t i = 0; i < 512; ++i)
+        {
+            auto & subentry = table->entries[i];
+            subentry = static_cast<std::uintptr_t>(base + i * subentry_size);
+            subentry.user = entry.user;
+            subentry.global = entry.global;
+            subentry.read_write = entry.read_write;
+            subentry.write_through = entry.write_through;
+            subentry.cache_disable = entry.cache_disable;
+
+            if constexpr (I - 1 == 1)
+            {
+                subentry.pat = pat;
+            }
+            else
+            {
+                subentry.address |= pat;
+            }
+        }
+
+        // the entry is built on the side and stored at once, so that page walks on other cores never see it
+        // half-way through the change; until the pages are invalidated, they may still use the large page,
+        // which maps the same memory
+        auto updated = entry;
+        updated = table;
+        updated.read_write = 1;
+        entry = updated;
+    }
+
     template<int I, int Lowest>
     [[gnu::always_inline]] void vm_map(
+        tlb_invalidator & invl,
         pmlt<I> * table,
         std::uintptr_t virt_start,
         std::uintptr_t virt_end,
@@ -216,6 +439,29 @@ namespace
 
             if constexpr (I == Lowest)
             {
+                if constexpr (I > 1)
+                {
+                    // the table may be left over from small pages that have been unmapped since; the entry
+                    // pointing to it can still be cached, so it can only be freed after an invalidation
+                    if (table->entries[start_table_index].present && !table->entries[start_table_index].size)
+                    {
+                        auto subtable = table->entries[start_table_index].get();
+                        for (auto && entry : subtable->entries)
+                        {
+                            if (entry.present)
+                            {
+                                PANIC(
+                                    "Tried to map a large page at {:#018x} over a page table that is in use!",
+                                    virt_start);
+                            }
+                        }
+
+                        table->entries[start_table_index].present = 0;
+                        invl.invalidate(virt_addr_t(virt_start));
+                        invl.free_frame(table->entries[start_table_index].get_phys());
+                    }
+                }
+
                 if (table->entries[start_table_index].present)
                 {
                     PANIC(
@@ -227,24 +473,54 @@ namespace
 
                 table->entries[start_table_index] = phys;
                 table->entries[start_table_index].user = flags & kernel::vm::flags::user;
+                // global entries survive switches of address spaces, so only the kernel's can be global
+                table->entries[start_table_index].global = !(flags & kernel::vm::flags::user);
+                table->entries[start_table_index].read_write = !(flags & kernel::vm::flags::read_only);
+                set_caching_mode(table->entries[start_table_index], flags);
             }
 
             else
             {
+                // when mapping with small pages, whole entries that the virtual and physical ranges are both
+                // aligned to are mapped with large (or huge, where supported) pages instead
+                if constexpr (Lowest == 1 && I <= 3)
+                {
+                    auto & entry = table->entries[start_table_index];
+                    if (!entry.present && (I == 2 || huge_pages_allowed) && !(virt_start & (entry_size - 1))
+                        && !(phys & (entry_size - 1)) && entry_virt_end - virt_start == entry_size)
+                    {
+                        entry = phys;
+                        entry.user = flags & kernel::vm::flags::user;
+                        entry.global = !(flags & kernel::vm::flags::user);
+                        entry.read_write = !(flags & kernel::vm::flags::read_only);
+                        set_caching_mode(entry, flags);
+
+                        ++start_table_index;
+                        phys += entry_size;
+                        virt_start = entry_virt_end;
+                        continue;
+                    }
+                }
+
                 if (table->entries[start_table_index].present == 0)
                 {
                     table->entries[start_table_index] = new pmlt<I - 1>{};
                 }
 
+                else if (table->entries[start_table_index].size == 1)
+                {
+                    PANIC("Tried to re-map page {:#018x}, which is a part of a large page!", virt_start);
+                }
+
                 table->entries[start_table_index].user |= flags & kernel::vm::flags::user;
 
                 vm_map<I - 1, Lowest>(
-                    table->entries[start_table_index].get(), virt_start, entry_virt_end, phys, flags);
+                    invl, table->entries[start_table_index].get(), virt_start, entry_virt_end, phys, flags);
             }
 
             ++start_table_index;
+            phys += entry_virt_end - virt_start;
             virt_start = entry_virt_end;
-            phys = (phys + entry_size) & ~(entry_size - 1);
         }
     }
 
@@ -269,37 +545,126 @@ namespace
             //                                 ^ this is a protection against overflow on highest
             //                                 addresses
 
+            // mappings of sparse VMOs only have the pages that have been faulted in mapped, so holes are
+            // expected here
+            if (table->entries[start_table_index].present == 0)
+            {
+                ++start_table_index;
+                virt_start = entry_virt_end;
+                continue;
+            }
+
             if constexpr (I == 1)
             {
-                if (table->entries[start_table_index].present == 0)
+                table->entries[start_table_index].present = false;
+                invl.invalidate(virt_addr_t(virt_start));
+
+                if (free_physical)
                 {
-                    PANIC("Tried to unmap an unmapped address {:#018x}!", virt_start);
+                    invl.free_frame(table->entries[start_table_index].get_phys());
                 }
+            }
 
-                if (free_physical)
+            else
+            {
+                if (table->entries[start_table_index].size == 1)
                 {
-                    auto frame = table->entries[start_table_index].get_phys();
-                    pmm::push(0, frame);
+                    if (entry_virt_end - virt_start == entry_size)
+                    {
+                        table->entries[start_table_index].present = false;
+                        invl.invalidate(virt_addr_t(virt_start));
+
+                        if (free_physical)
+                        {
+                            if constexpr (I != 2)
+                            {
+                                PANIC("tried to free the frame of a huge page at {:#018x}", virt_start);
+                            }
+
+                            invl.free_large_frame(table->entries[start_table_index].get_phys());
+                        }
+
+                        ++start_table_index;
+                        virt_start = entry_virt_end;
+                        continue;
+                    }
+
+                    // frames are only ever freed whole
+                    if (free_physical)
+                    {
+                        PANIC("tried to free a part of the frame of a large page at {:#018x}", virt_start);
+                    }
+
+                    split_large_page(table->entries[start_table_index]);
                 }
 
-                table->entries[start_table_index].present = false;
-                invl.invalidate(virt_addr_t(virt_start));
+                vm_unmap<I - 1>(
+                    invl, table->entries[start_table_index].get(), virt_start, entry_virt_end, free_physical);
             }
 
-            else
+            ++start_table_index;
+            virt_start = entry_virt_end;
+        }
+    }
+
+    template<int I>
+    [[gnu::always_inline]] void vm_write_protect(
+        tlb_invalidator & invl,
+        pmlt<I> * table,
+        std::uintptr_t virt_start,
+        std::uintptr_t virt_end)
+    {
+        auto start_table_index = (virt_start >> (I * 9 + 3)) & 511;
+
+        constexpr auto entry_size = 1ull << (I * 9 + 3);
+
+        while (virt_start < virt_end)
+        {
+            util::bit_lock<62> _(&table->entries[start_table_index]);
+
+            auto entry_virt_end = (virt_start + entry_size) & ~(entry_size - 1);
+            entry_virt_end = (entry_virt_end - 1) < virt_end && entry_virt_end ? entry_virt_end : virt_end;
+            //                                 ^ this is a protection against overflow on highest
+            //                                 addresses
+
+            if (table->entries[start_table_index].present == 0)
             {
-                if (table->entries[start_table_index].present == 0)
+                ++start_table_index;
+                virt_start = entry_virt_end;
+                continue;
+            }
+
+            if constexpr (I == 1)
+            {
+                if (table->entries[start_table_index].read_write)
                 {
-                    PANIC("Tried to unmap an unmapped address {:#018x}!", virt_start);
+                    table->entries[start_table_index].read_write = false;
+                    invl.invalidate(virt_addr_t(virt_start));
                 }
+            }
 
+            else
+            {
                 if (table->entries[start_table_index].size == 1)
                 {
-                    PANIC("tried to unmap large page, this is not implemented yet ({:#018x})", virt_start);
+                    if (entry_virt_end - virt_start == entry_size)
+                    {
+                        if (table->entries[start_table_index].read_write)
+                        {
+                            table->entries[start_table_index].read_write = false;
+                            invl.invalidate(virt_addr_t(virt_start));
+                        }
+
+                        ++start_table_index;
+                        virt_start = entry_virt_end;
+                        continue;
+                    }
+
+                    split_large_page(table->entries[start_table_index]);
                 }
 
-                vm_unmap<I - 1>(
-                    invl, table->entries[start_table_index].get(), virt_start, entry_virt_end, free_physical);
+                vm_write_protect<I - 1>(
+                    invl, table->entries[start_table_index].get(), virt_start, entry_virt_end);
             }
 
             ++start_table_index;
@@ -308,13 +673,13 @@ namespace
     }
 
     template<int I>
-    [[gnu::always_inline]] phys_addr_t vm_virt_to_phys(pmlt<I> * table, std::uintptr_t virt)
+    [[gnu::always_inline]] std::optional<phys_addr_t> vm_virt_to_phys(pmlt<I> * table, std::uintptr_t virt)
     {
         auto table_index = (virt >> (I * 9 + 3)) & 511;
 
         if (table->entries[table_index].present == 0)
         {
-            PANIC("Tried to probe an unmapped address ({:#018x})!", virt);
+            return std::nullopt;
         }
 
         if constexpr (I == 1)
@@ -326,7 +691,8 @@ namespace
         {
             if (table->entries[table_index].size == 1)
             {
-                return table->entries[table_index].get_phys();
+                constexpr auto entry_size = 1ull << (I * 9 + 3);
+                return table->entries[table_index].get_phys() + (virt & (entry_size - 1));
             }
 
             return vm_virt_to_phys<I - 1>(table->entries[table_index].get(), virt);
@@ -342,6 +708,11 @@ namespace
     constexpr auto huge_page_mask = ~(huge_page_size - 1);
 }
 
+void enable_huge_pages()
+{
+    huge_pages_allowed = true;
+}
+
 void map_physical(virt_addr_t start, virt_addr_t end, phys_addr_t physical, kernel::vm::flags flags)
 {
     map_physical(nullptr, start, end, physical, flags);
@@ -352,7 +723,8 @@ void map_physical(
     virt_addr_t start,
     virt_addr_t end,
     phys_addr_t physical,
-    kernel::vm::flags flags)
+    kernel::vm::flags flags,
+    std::size_t page_layer)
 {
     auto size = end.value() - start.value();
 
@@ -366,9 +738,32 @@ void map_physical(
 
     auto phys_int = physical.value() & page_mask;
 
-    auto cr3 = phys_ptr_t<pml4_t>(address_space ? address_space->get_asid() : get_asid()).value();
+    auto cr3_phys = address_space ? address_space->get_asid() : get_asid();
+    auto cr3 = phys_ptr_t<pml4_t>(cr3_phys).value();
+    tlb_invalidator invl(start > 0x8000000000000000 ? nullptr : address_space);
+
+    switch (page_layer)
+    {
+        case 0:
+            vm_map<4, 1>(invl, cr3, virt_start, virt_end, phys_int, flags);
+            break;
+
+        case 1:
+            if ((virt_start | virt_end | phys_int) & ~large_page_mask)
+            {
+                PANIC(
+                    "Tried to map {:#018x}-{:#018x} to {:#018x} with large pages, which it isn't aligned to!",
+                    virt_start,
+                    virt_end,
+                    phys_int);
+            }
 
-    vm_map<4, 1>(cr3, virt_start, virt_end, phys_int, flags);
+            vm_map<4, 2>(invl, cr3, virt_start, virt_end, phys_int, flags);
+            break;
+
+        default:
+            PANIC("Mapping with pages of layer {} is not supported!", page_layer);
+    }
 }
 
 void unmap(virt_addr_t start, virt_addr_t end, bool free_physical)
@@ -390,17 +785,47 @@ void unmap(kernel::vm::vas * address_space, virt_addr_t start, virt_addr_t end,
 
     auto cr3_phys = address_space ? address_space->get_asid() : get_asid();
     auto cr3 = phys_ptr_t<pml4_t>(cr3_phys).value();
-    tlb_invalidator invl(start > 0x8000000000000000 ? std::nullopt : std::optional(cr3_phys));
+    tlb_invalidator invl(start > 0x8000000000000000 ? nullptr : address_space);
 
     vm_unmap<4>(invl, cr3, virt_start, virt_end, free_physical);
 }
 
+void write_protect(kernel::vm::vas * address_space, virt_addr_t start, virt_addr_t end)
+{
+    auto size = end.value() - start.value();
+
+    if (size == 0)
+    {
+        return;
+    }
+
+    auto virt_start = start.value() & page_mask;
+    auto virt_end = (virt_start + size + page_size - 1) & page_mask;
+
+    auto cr3_phys = address_space ? address_space->get_asid() : get_asid();
+    auto cr3 = phys_ptr_t<pml4_t>(cr3_phys).value();
+    tlb_invalidator invl(start > 0x8000000000000000 ? nullptr : address_space);
+
+    vm_write_protect<4>(invl, cr3, virt_start, virt_end);
+}
+
 phys_addr_t virt_to_phys(virt_addr_t address)
 {
     return virt_to_phys(nullptr, address);
 }
 
 phys_addr_t virt_to_phys(kernel::vm::vas * address_space, virt_addr_t address)
+{
+    auto physical = try_virt_to_phys(address_space, address);
+    if (!physical)
+    {
+        PANIC("Tried to probe an unmapped address ({:#018x})!", address.value());
+    }
+
+    return *physical;
+}
+
+std::optional<phys_addr_t> try_virt_to_phys(kernel::vm::vas * address_space, virt_addr_t address)
 {
     auto cr3 = phys_ptr_t<pml4_t>(address_space ? address_space->get_asid() : get_asid()).value();
 
@@ -410,7 +835,11 @@ phys_addr_t virt_to_phys(kernel::vm::vas * address_space, virt_addr_t address)
 namespace
 {
     template<int I>
-    [[gnu::always_inline]] void unmap_all(pmlt<I> * table, std::size_t first, std::size_t last)
+    [[gnu::always_inline]] void unmap_all(
+        pmlt<I> * table,
+        std::size_t first,
+        std::size_t last,
+        pmm::frame_batch & freed)
     {
         if constexpr (I != 1)
         {
@@ -423,12 +852,13 @@ namespace
 
                 if (table->entries[first].present == 1)
                 {
+                    // large pages map memory that isn't owned by the page tables
                     if (!table->entries[first].size)
                     {
-                        unmap_all(table->entries[first].get(), 0, 511);
+                        unmap_all(table->entries[first].get(), 0, 511, freed);
+                        freed.push(table->entries[first].get_phys());
                     }
                     table->entries[first].present = 0;
-                    pmm::push(0, table->entries[first].get_phys());
                 }
 
                 ++first;
@@ -469,8 +899,25 @@ void unmap_lower_half()
 
     auto cr3 = phys_ptr_t<pml4_t>(get_asid()).value();
 
-    unmap_all(cr3, 0, 255);
+    pmm::frame_batch freed(0);
+    unmap_all(cr3, 0, 255, freed);
 
     kernel::mp::parallel_execute([] { asm volatile("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "memory"); });
 }
+
+void release_asid(phys_addr_t asid)
+{
+    // a new address space may get the same top-level table, and must not inherit the TLB entries that are
+    // still tagged with the PCIDs of this one; this is also the only flush the freed page tables need, as
+    // nothing can walk them once the address space isn't loaded anywhere
+    kernel::mp::parallel_execute(
+        kernel::mp::policy::all,
+        +[](phys_addr_t asid) { cpu::get_current_core()->get_pcid_cache()->forget(asid); },
+        asid);
+
+    pmm::frame_batch freed(0);
+    unmap_all(phys_ptr_t<pml4_t>(asid).value(), 0, 255, freed);
+    freed.push(asid);
+}
+
 }
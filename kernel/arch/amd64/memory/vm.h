@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -18,6 +18,9 @@
 
 #include "../../../memory/vm.h"
 #include "../../../util/integer_types.h"
+#include "../../../util/mp.h"
+
+#include <optional>
 
 namespace kernel::vm
 {
@@ -29,27 +32,111 @@ namespace kernel::amd64::vm
 constexpr std::size_t page_size_count = 3;
 constexpr std::size_t page_sizes[] = { 4 * 1024, 2 * 1024 * 1024, 1 * 1024 * 1024 * 1024 };
 
+// The PCIDs that a core has handed out to the address spaces that ran on it recently. TLB entries are tagged
+// with the PCID of the address space they belong to, so switching back to an address space that still has
+// its PCID doesn't need to flush them. Only ever touched by its own core, with interrupts disabled.
+class pcid_cache
+{
+public:
+    struct assignment
+    {
+        std::uint16_t pcid;
+        // false if the TLB entries tagged with the PCID may be stale, and must be flushed when it's loaded
+        bool keep_entries;
+    };
+
+    void enable()
+    {
+        _enabled = true;
+    }
+
+    bool is_enabled() const
+    {
+        return _enabled;
+    }
+
+    // Returns the PCID of the address space on this core; if it has none, the least recently used one is
+    // taken away from whichever address space had it. The entries tagged with the PCID are only kept if
+    // there were no shootdowns in the address space since it was last loaded, i.e. if its TLB generation is
+    // still the same.
+    assignment assign(phys_addr_t asid, std::uint64_t generation);
+    // Takes the PCID away from the address space, if it has one, and makes it be flushed when reused.
+    void forget(phys_addr_t asid);
+    // Makes the TLB entries of every address space but the current one be flushed the next time they are
+    // switched to on this core; used when kernel mappings change, as those are cached under every PCID.
+    void invalidate_others(phys_addr_t current);
+
+private:
+    // PCID 0 is never handed out, it's left to the boot address space, that runs before PCIDs are enabled
+    static constexpr std::size_t _slot_count = 16;
+
+    struct _slot
+    {
+        phys_addr_t asid;
+        bool assigned = false;
+        bool keep_entries = false;
+        std::uint64_t generation = 0;
+        std::uint64_t last_used = 0;
+    };
+
+    bool _enabled = false;
+    std::uint64_t _clock = 0;
+    _slot _slots[_slot_count];
+};
+
+// The TLB bookkeeping of an address space. Shootdowns only interrupt the cores that have the address space
+// loaded; cores that have switched away from it may still hold its TLB entries under its PCID, but every
+// shootdown bumps the generation, and they flush those entries once they switch back, if it has changed.
+struct tlb_state
+{
+    kernel::mp::core_mask loaded_on;
+    std::atomic<std::uint64_t> generation = 0;
+};
+
+// Loads the address space as is, flushing the TLB.
 void set_asid(phys_addr_t asid);
 phys_addr_t get_asid();
 
+// Switches the current core from one address space to another. When PCIDs are enabled on the core, the TLB is
+// only flushed if the address space hasn't run on it recently, or its mappings have changed since.
+void switch_address_space(kernel::vm::vas * from, kernel::vm::vas * to);
+
+// Lets map_physical use 1 GiB pages; only called if the CPU supports them.
+void enable_huge_pages();
+
 void map_physical(
     virt_addr_t begin,
     virt_addr_t end,
     phys_addr_t physical,
     kernel::vm::flags flags = kernel::vm::flags::none);
+// Maps the range with pages of the given layer; `begin`, `end` and `physical` must be aligned to their size.
+// A page table that is in the way of a large page must be empty, and is freed. When mapping with small
+// pages, the parts of the range that line up with large (or huge) pages on both sides, and have nothing
+// mapped there yet, are mapped with those instead.
 void map_physical(
     kernel::vm::vas * address_space,
     virt_addr_t begin,
     virt_addr_t end,
     phys_addr_t physical,
-    kernel::vm::flags flags = kernel::vm::flags::none);
+    kernel::vm::flags flags = kernel::vm::flags::none,
+    std::size_t page_layer = 0);
 
+// Large pages that are only partially covered by the range are split first. Frames of large pages are freed
+// as large frames, so with `free_physical`, the range must cover large pages whole.
 void unmap(virt_addr_t begin, virt_addr_t end, bool free_physical);
 void unmap(kernel::vm::vas * address_space, virt_addr_t begin, virt_addr_t end, bool free_physical);
 
+// Makes the pages that are mapped in the range read-only. Large pages that are only partially covered by the
+// range are split first.
+void write_protect(kernel::vm::vas * address_space, virt_addr_t begin, virt_addr_t end);
+
 phys_addr_t virt_to_phys(virt_addr_t address);
 phys_addr_t virt_to_phys(kernel::vm::vas * address_space, virt_addr_t address);
+std::optional<phys_addr_t> try_virt_to_phys(kernel::vm::vas * address_space, virt_addr_t address);
 
 phys_addr_t clone_upper_half();
 void unmap_lower_half();
+// Frees the lower half of an address space created with clone_upper_half, page tables included (but not the
+// memory they map), along with its top-level table. The address space must not be loaded on any core.
+void release_asid(phys_addr_t asid);
 }
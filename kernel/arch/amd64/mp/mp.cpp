@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -194,6 +194,14 @@ void boot()
             {
                 log::println(" > CPU#{} failed to boot!", cores[i].apic_id());
 
+                // the core never picked up its trampoline after two SIPIs, so nothing runs on the stack
+                // prepared for it; give it back before the slot is reused by the next core
+                auto stack_top = *phys_ptr_t<std::uint64_t>(
+                    base + trampoline_size * (i - booted) + stack_slot_offset);
+                auto stack = virt_addr_t(stack_top - 32 * 4096);
+                vm::unmap(stack, virt_addr_t(stack_top), true);
+                kernel::vm::free_address_range(stack, 32 * 4096);
+
                 for (std::size_t j = i; j < core_count - 1; ++j)
                 {
                     log::println(
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -20,6 +20,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 namespace kernel::acpi
 {
@@ -212,6 +213,60 @@ namespace
         std::uint8_t page_protection;
     };
 
+    struct [[gnu::packed]] srat_entry_header
+    {
+        std::uint8_t type;
+        std::uint8_t length;
+    };
+
+    struct [[gnu::packed]] srat_lapic_affinity : public srat_entry_header
+    {
+        std::uint8_t proximity_domain_low;
+        std::uint8_t apic_id;
+        std::uint32_t flags;
+        std::uint8_t local_sapic_eid;
+        std::uint8_t proximity_domain_high[3];
+        std::uint32_t clock_domain;
+    };
+
+    struct [[gnu::packed]] srat_memory_affinity : public srat_entry_header
+    {
+        std::uint32_t proximity_domain;
+        std::uint16_t reserved1;
+        std::uint64_t base_address;
+        std::uint64_t length;
+        std::uint32_t reserved2;
+        std::uint32_t flags;
+        std::uint64_t reserved3;
+    };
+
+    struct [[gnu::packed]] srat_x2apic_affinity : public srat_entry_header
+    {
+        std::uint16_t reserved1;
+        std::uint32_t proximity_domain;
+        std::uint32_t x2apic_id;
+        std::uint32_t flags;
+        std::uint32_t clock_domain;
+        std::uint32_t reserved2;
+    };
+
+    struct [[gnu::packed]] srat : public description_header
+    {
+        static const constexpr char expected_signature[] = "SRAT";
+
+        std::uint32_t table_revision;
+        std::uint64_t reserved;
+        srat_entry_header entries[1];
+    };
+
+    struct [[gnu::packed]] slit : public description_header
+    {
+        static const constexpr char expected_signature[] = "SLIT";
+
+        std::uint64_t locality_count;
+        std::uint8_t entries[1];
+    };
+
     template<typename Table, typename Root>
     phys_ptr_t<Table> find_table(Root root)
     {
@@ -230,12 +285,17 @@ namespace
     template<typename Table>
     phys_ptr_t<Table> find_table()
     {
-        if (root_xsdt.value())
+        if (root_xsdt)
         {
             return find_table<Table>(root_xsdt);
         }
 
-        return find_table<Table>(root_rsdt);
+        if (root_rsdt)
+        {
+            return find_table<Table>(root_rsdt);
+        }
+
+        return {};
     }
 }
 
@@ -274,6 +334,14 @@ void initialize(std::size_t, phys_addr_t acpi_root)
     } while (false);
 }
 
+void release_tables()
+{
+    log::println("[ACPI] Releasing ACPI tables.");
+
+    root_xsdt = phys_ptr_t<xsdt>{ nullptr };
+    root_rsdt = phys_ptr_t<rsdt>{ nullptr };
+}
+
 acpi::madt_result parse_madt(arch::cpu::core * cores_storage, std::size_t max_core_count)
 {
     auto madt_ptr = find_table<madt>();
@@ -481,4 +549,135 @@ hpet_result parse_hpet()
 
     return { hpet_ptr->address.address, hpet_ptr->minimum_tick };
 }
+
+std::size_t parse_srat_memory(srat_memory_range * ranges_storage, std::size_t max_range_count)
+{
+    auto srat_ptr = find_table<srat>();
+    if (!srat_ptr)
+    {
+        log::println(" > SRAT not found, assuming a single NUMA domain.");
+        return 0;
+    }
+
+    log::println(" > Found SRAT at {}.", srat_ptr.raw_value());
+
+    std::size_t detected_ranges = 0;
+    auto entry = srat_ptr->entries;
+
+    while (reinterpret_cast<std::uintptr_t>(entry) - reinterpret_cast<std::uintptr_t>(srat_ptr.value())
+           < srat_ptr->length)
+    {
+        if (entry->type == 1)
+        {
+            auto memory = static_cast<srat_memory_affinity *>(entry);
+            std::uint64_t base = memory->base_address;
+            std::uint64_t length = memory->length;
+            std::uint32_t domain = memory->proximity_domain;
+
+            if (memory->flags & 1 && length)
+            {
+                log::println(
+                    " > Found a memory affinity entry: {:#018x} - {:#018x}, domain {}.",
+                    base,
+                    base + length,
+                    domain);
+
+                if (detected_ranges < max_range_count)
+                {
+                    ranges_storage[detected_ranges] = { phys_addr_t{ base }, length, domain };
+                }
+                ++detected_ranges;
+            }
+        }
+
+        entry =
+            reinterpret_cast<srat_entry_header *>(reinterpret_cast<std::uintptr_t>(entry) + entry->length);
+    }
+
+    if (detected_ranges > max_range_count)
+    {
+        log::println(
+            " > Warning: detected more memory affinity entries than supported, only the first {} will be "
+            "used.",
+            max_range_count);
+        return max_range_count;
+    }
+
+    return detected_ranges;
+}
+
+void parse_srat_cores(arch::cpu::core * cores_storage, std::size_t core_count)
+{
+    auto srat_ptr = find_table<srat>();
+    if (!srat_ptr)
+    {
+        return;
+    }
+
+    auto assign = [&](std::uint32_t apic_id, std::uint32_t domain)
+    {
+        for (auto i = 0ull; i < core_count; ++i)
+        {
+            if (cores_storage[i].apic_id() == apic_id)
+            {
+                log::println(" > Core with APIC ID {} is in domain {}.", apic_id, domain);
+                cores_storage[i].set_proximity_domain(domain);
+                return;
+            }
+        }
+    };
+
+    auto entry = srat_ptr->entries;
+
+    while (reinterpret_cast<std::uintptr_t>(entry) - reinterpret_cast<std::uintptr_t>(srat_ptr.value())
+           < srat_ptr->length)
+    {
+        switch (entry->type)
+        {
+            case 0:
+            {
+                auto lapic = static_cast<srat_lapic_affinity *>(entry);
+                if (lapic->flags & 1)
+                {
+                    auto domain = lapic->proximity_domain_low | (lapic->proximity_domain_high[0] << 8)
+                        | (lapic->proximity_domain_high[1] << 16) | (lapic->proximity_domain_high[2] << 24);
+                    assign(lapic->apic_id, domain);
+                }
+                break;
+            }
+
+            case 2:
+            {
+                auto x2apic = static_cast<srat_x2apic_affinity *>(entry);
+                if (x2apic->flags & 1)
+                {
+                    assign(x2apic->x2apic_id, x2apic->proximity_domain);
+                }
+                break;
+            }
+        }
+
+        entry =
+            reinterpret_cast<srat_entry_header *>(reinterpret_cast<std::uintptr_t>(entry) + entry->length);
+    }
+}
+
+std::size_t copy_numa_distances(std::uint8_t * distances_storage, std::size_t max_locality_count)
+{
+    auto slit_ptr = find_table<slit>();
+    if (!slit_ptr)
+    {
+        return 0;
+    }
+
+    std::size_t locality_count = slit_ptr->locality_count;
+    if (locality_count > max_locality_count)
+    {
+        log::println(" > Warning: SLIT describes too many domains ({}), ignoring it.", locality_count);
+        return 0;
+    }
+
+    std::memcpy(distances_storage, slit_ptr->entries, locality_count * locality_count);
+    return locality_count;
+}
 }
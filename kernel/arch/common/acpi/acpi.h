@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -22,6 +22,9 @@
 namespace kernel::acpi
 {
 void initialize(std::size_t revision, phys_addr_t acpi_root);
+// Drops all references to the ACPI tables, so that the memory they live in can be reclaimed; after this, the
+// tables are treated as absent.
+void release_tables();
 
 struct madt_result
 {
@@ -36,4 +39,18 @@ struct hpet_result
     std::uint16_t min_tick;
 };
 hpet_result parse_hpet();
+
+struct srat_memory_range
+{
+    phys_addr_t base;
+    std::size_t length;
+    std::uint32_t proximity_domain;
+};
+std::size_t parse_srat_memory(srat_memory_range * ranges_storage, std::size_t max_range_count);
+void parse_srat_cores(arch::cpu::core * cores_storage, std::size_t core_count);
+
+// Copies the matrix of distances between proximity domains from SLIT, if there is one with no more than
+// `max_locality_count` domains, and returns the number of domains in it; returns 0 otherwise. Entry
+// `from * count + to` is the distance from domain `from` to domain `to`.
+std::size_t copy_numa_distances(std::uint8_t * distances_storage, std::size_t max_locality_count);
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -33,6 +33,8 @@ namespace kernel::arch::cpu
 {
 using arch_namespace::cpu::core;
 using arch_namespace::cpu::get_core_count;
+using arch_namespace::cpu::get_random;
+using arch_namespace::cpu::get_timestamp_counter;
 using arch_namespace::cpu::idle;
 using arch_namespace::cpu::initialize;
 using arch_namespace::cpu::switch_to_clean_state;
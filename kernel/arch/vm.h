@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -35,13 +35,18 @@ using arch_namespace::vm::page_sizes;
 
 using arch_namespace::vm::get_asid;
 using arch_namespace::vm::set_asid;
+using arch_namespace::vm::switch_address_space;
+using arch_namespace::vm::tlb_state;
 
 using arch_namespace::vm::map_physical;
 using arch_namespace::vm::unmap;
+using arch_namespace::vm::write_protect;
 
+using arch_namespace::vm::try_virt_to_phys;
 using arch_namespace::vm::virt_to_phys;
 
 using arch_namespace::vm::clone_upper_half;
+using arch_namespace::vm::release_asid;
 }
 
 #undef arch_namespace
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,10 +16,12 @@
 
 #include "screen.h"
 
+#include "../arch/vm.h"
+#include "../util/log.h"
+
 #include <boot-constants.h>
 
 #include <cstring>
-#include "../util/log.h"
 
 asm("bitmap_font:\n"
     ".incbin \"" REAVEROS_KERNEL_SOURCE_ROOT "/boot/IBM_VGA_8x16.bin\"\n");
@@ -61,6 +63,37 @@ void initialize(
     clear();
 }
 
+void enable_write_combining()
+{
+    if (!valid)
+    {
+        return;
+    }
+
+    // the backbuffer is only ever written and read by the CPU, so it stays in the write-back physical memory
+    // window; the framebuffer is only written to, in long runs, which is what write-combining is for
+    auto physical = reinterpret_cast<std::uintptr_t>(mode.framebuffer_base);
+    auto offset = physical % arch::vm::page_sizes[0];
+
+    auto base = vm::allocate_address_range(offset + mode.framebuffer_size);
+    arch::vm::map_physical(
+        base,
+        base + offset + mode.framebuffer_size,
+        phys_addr_t(physical - offset),
+        vm::flags::write_combining);
+
+    framebuffer_base = reinterpret_cast<std::uint32_t *>(base.value() + offset);
+
+    // the physical memory window maps the framebuffer write-back; mapping the same memory with two different
+    // memory types is undefined, so the alias in the window is removed
+    auto page_size = arch::vm::page_sizes[0];
+    auto physical_end = (physical + mode.framebuffer_size + page_size - 1) / page_size * page_size;
+    arch::vm::unmap(
+        virt_addr_t(boot_protocol::physmem_base + physical - offset),
+        virt_addr_t(boot_protocol::physmem_base + physical_end),
+        false);
+}
+
 void put_char(char c)
 {
     if (!valid)
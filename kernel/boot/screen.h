@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -26,6 +26,10 @@ void initialize(
     std::size_t memmap_size,
     boot_protocol::memory_map_entry * memmap);
 
+// Moves the framebuffer from the physical memory window to a write-combining mapping. Must be called after
+// the CPU has been initialized, and before other cores are started.
+void enable_write_combining();
+
 void clear();
 void scroll();
 void put_char(char c);
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022-2025 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -37,8 +37,6 @@ std::uintptr_t vdso_size;
 
 namespace bootinit::process
 {
-std::uintptr_t top_of_image = addresses::top_of_stack.value() + kernel::arch::vm::page_sizes[0];
-
 template<typename T>
 struct allocate_array_result
 {
@@ -120,33 +118,100 @@ struct allocate_array_result
     std::uintptr_t vmo_token = 0;
 };
 
+// Maps an existing VMO, taking over the token, without constructing any objects in it.
 template<typename T>
-allocate_array_result<T> allocate_array(std::size_t n)
+allocate_array_result<T> map_array(std::uintptr_t vmo_token, std::size_t n)
 {
     allocate_array_result<T> ret;
     ret.size = n;
+    ret.vmo_token = vmo_token;
+
+    std::uintptr_t address;
+    auto result = sc::rose_mapping_create(
+        facts::self_vas_token,
+        ret.vmo_token,
+        0,
+        std::to_underlying(sc::mapping_create_flags::anywhere),
+        &ret.mapping_token,
+        &address);
+    if (result != sc::result::ok)
+    {
+        PANIC("failed to map a VMO!");
+    }
 
-    auto result = sc::rose_vmo_create(sizeof(T) * n, 0, &ret.vmo_token);
+    ret.ptr = reinterpret_cast<T *>(address);
+
+    return ret;
+}
+
+template<typename T>
+allocate_array_result<T> allocate_array(std::size_t n)
+{
+    std::uintptr_t vmo_token;
+    auto result = sc::rose_vmo_create(sizeof(T) * n, 0, &vmo_token);
     if (result != sc::result::ok)
     {
         PANIC("failed to create a VMO!");
     }
 
-    result =
-        sc::rose_mapping_create(facts::self_vas_token, ret.vmo_token, top_of_image, 0, &ret.mapping_token);
+    auto ret = map_array<T>(vmo_token, n);
+    new (ret.ptr) T[n];
+
+    return ret;
+}
+
+// The contents of the load segments of every image are only copied out of the initrd once, into a template
+// VMO; processes get copy-on-write clones of it, so only the pages that are written to by relocations, or
+// later on by the process itself, ever get copied again.
+struct segment_template
+{
+    std::string_view filename;
+    std::size_t segment_index;
+    std::uintptr_t vmo_token;
+};
+
+constexpr std::size_t max_segment_templates = 64;
+segment_template segment_templates[max_segment_templates];
+std::size_t segment_template_count = 0;
+
+std::uintptr_t get_segment_template(
+    std::string_view filename,
+    std::size_t segment_index,
+    std::size_t size,
+    const char * contents,
+    std::size_t contents_size)
+{
+    for (std::size_t i = 0; i < segment_template_count; ++i)
+    {
+        if (segment_templates[i].filename == filename && segment_templates[i].segment_index == segment_index)
+        {
+            return segment_templates[i].vmo_token;
+        }
+    }
+
+    if (segment_template_count == max_segment_templates)
+    {
+        PANIC("too many load segments in the initrd images!");
+    }
+
+    std::uintptr_t vmo_token;
+    auto result = sc::rose_vmo_create(size, 0, &vmo_token);
     if (result != sc::result::ok)
     {
-        PANIC("failed to map a VMO!");
+        PANIC("failed to create a segment template VMO: {}!", std::to_underlying(result));
     }
 
-    ret.ptr = new (reinterpret_cast<T *>(top_of_image)) T[n];
+    // the template never needs to be mapped here; the rest of the segment is already zeroed, since VMOs are
+    // zero-filled by the kernel
+    result = sc::rose_vmo_write(vmo_token, 0, reinterpret_cast<std::uintptr_t>(contents), contents_size);
+    if (result != sc::result::ok)
+    {
+        PANIC("failed to fill a segment template VMO: {}!", std::to_underlying(result));
+    }
 
-    top_of_image += sizeof(T) * n;
-    top_of_image += kernel::arch::vm::page_sizes[0] - 1;
-    top_of_image &= ~(kernel::arch::vm::page_sizes[0] - 1);
-    top_of_image += kernel::arch::vm::page_sizes[0];
+    segment_templates[segment_template_count++] = { filename, segment_index, vmo_token };
 
-    return ret;
+    return vmo_token;
 }
 
 struct segment_mapping
@@ -597,20 +662,32 @@ loaded_elf load_elf_with_dependencies(
 
         auto segment_vmo_size = segment_end_aligned - segment_base;
 
-        auto segment_storage = allocate_array<char>(segment_vmo_size);
+        auto template_token = get_segment_template(
+            filename,
+            i,
+            segment_vmo_size,
+            ret.image->data() + program_header.offset(),
+            program_header.file_size());
 
-        auto segment_file_size = program_header.file_size();
+        std::uintptr_t segment_token;
+        auto result = sc::rose_vmo_clone(template_token, 0, segment_vmo_size, &segment_token);
+        if (result != sc::result::ok)
+        {
+            PANIC("failed to clone segment #{}'s template VMO: {}!", i, std::to_underlying(result));
+        }
 
-        std::memcpy(
-            segment_storage.ptr, ret.image->data() + program_header.offset(), program_header.file_size());
-        std::memset(segment_storage.ptr + segment_file_size, 0, segment_size - segment_file_size);
+        // mapped here too, so that relocations can be applied to it
+        auto segment_storage = map_array<char>(segment_token, segment_vmo_size);
 
-        auto result = sc::rose_mapping_create(
+        // the segments of an image must keep their relative placement, so they go at fixed addresses
+        std::uintptr_t segment_address;
+        result = sc::rose_mapping_create(
             vas_token,
             segment_storage.vmo_token,
             binary_base + segment_base,
             0,
-            &ret.segment_mappings[i].target_mapping_token);
+            &ret.segment_mappings[i].target_mapping_token,
+            &segment_address);
         if (result != sc::result::ok)
         {
             PANIC("failed to map segment #{}'s VMO in the target VAS: {}!", i, std::to_underlying(result));
@@ -824,16 +901,22 @@ create_process_result create_process(
         PANIC("failed to create a stack VMO!");
     }
 
-    std::uintptr_t top_of_stack = 0x80000000;
-    std::uintptr_t stack_map_base = top_of_stack - 31 * kernel::arch::vm::page_sizes[0];
-
     std::uintptr_t stack_mapping;
-    result = sc::rose_mapping_create(ret.vas_token, stack_token, stack_map_base, 0, &stack_mapping);
+    std::uintptr_t stack_map_base;
+    result = sc::rose_mapping_create(
+        ret.vas_token,
+        stack_token,
+        0,
+        std::to_underlying(sc::mapping_create_flags::anywhere | sc::mapping_create_flags::randomize),
+        &stack_mapping,
+        &stack_map_base);
     if (result != sc::result::ok)
     {
         PANIC("failed to map a stack VMO!");
     }
 
+    std::uintptr_t top_of_stack = stack_map_base + 31 * kernel::arch::vm::page_sizes[0];
+
     result = sc::rose_token_release(stack_token);
     if (result != sc::result::ok)
     {
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2025 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -220,6 +220,7 @@ void log_acceptor(std::uintptr_t accept_mailbox, kernel::vm::vmo_mapping * mappi
         // TODO: abstraction for this, create_kernel_thread or something
         auto log_stack_addr = kernel::vm::allocate_address_range(32 * kernel::arch::vm::page_sizes[0]);
         auto log_stack_vmo = kernel::vm::create_sparse_vmo(31 * kernel::arch::vm::page_sizes[0]);
+        // kernel stacks can't be faulted in on demand, since handling the fault requires a working stack
         log_stack_vmo->commit_all();
         auto log_stack_mapping = process->get_vas()->map_vmo(
             std::move(log_stack_vmo), log_stack_addr + kernel::arch::vm::page_sizes[0]);
@@ -271,14 +272,20 @@ extern "C" [[gnu::section(".reaveros_entry")]] void kernel_main(boot_protocol::k
     kernel::log::println("Copyright (C) 2021-2025 Reaver Project Team");
     kernel::log::println("");
 
+    // ACPI tables need to be available to the PMM to discover NUMA topology
+    kernel::acpi::initialize(args.acpi_revision, kernel::phys_addr_t{ args.acpi_root });
+
     kernel::pmm::initialize(args.memory_map_size, args.memory_map_entries);
     kernel::pmm::report();
+    kernel::vm::initialize_zero_frame();
 
-    kernel::acpi::initialize(args.acpi_revision, kernel::phys_addr_t{ args.acpi_root });
     kernel::arch::cpu::initialize();
+    kernel::boot_screen::enable_write_combining();
     kernel::time::initialize();
 
     kernel::arch::mp::boot();
+    kernel::pmm::enable_per_core_caches();
+    kernel::vm::enable_per_core_caches();
     kernel::mp::initialize_parallel();
     kernel::time::initialize_multicore();
     kernel::scheduler::initialize();
@@ -325,13 +332,12 @@ extern "C" [[gnu::section(".reaveros_entry")]] void kernel_main(boot_protocol::k
         bootinit_vas->map_vmo(std::move(vdso_vmo), bootinit::addresses::vdso, kernel::vm::flags::user);
 
         kernel::log::println(" > Creating and mapping the initrd VMO...");
-        auto initrd_vmo = kernel::vm::create_physical_vmo(initrd_base, initrd_size);
+        // the initrd is reclaimed by the PMM once bootinit is done with it, and the VMO is destroyed
+        auto initrd_vmo = kernel::vm::create_boot_memory_vmo(initrd_base, initrd_size);
         bootinit_vas->map_vmo(std::move(initrd_vmo), bootinit::addresses::initrd, kernel::vm::flags::user);
 
         kernel::log::println(" > Creating and mapping the bootinit stack VMO...");
         auto bootinit_stack_vmo = kernel::vm::create_sparse_vmo(31 * kernel::arch::vm::page_sizes[0]);
-        // TODO: remove this once on-demand mappings are a thing
-        bootinit_stack_vmo->commit_all();
         bootinit_vas->map_vmo(
             std::move(bootinit_stack_vmo),
             bootinit::addresses::top_of_stack - 31 * kernel::arch::vm::page_sizes[0],
@@ -400,6 +406,10 @@ extern "C" [[gnu::section(".reaveros_entry")]] void kernel_main(boot_protocol::k
             kernel::scheduler::schedule(std::move(bootinit_thread));
         }
 
+        // nothing refers to the memory of the loader and the early boot stages anymore
+        kernel::pmm::reclaim_boot_memory();
+        kernel::pmm::report();
+
         kernel::arch::cpu::idle();
     }
     ();
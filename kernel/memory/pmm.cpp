@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -15,98 +15,1175 @@
  */
 
 #include "pmm.h"
+#include "../arch/common/acpi/acpi.h"
+#include "../arch/cpu.h"
+#include "../util/interrupt_control.h"
 #include "../util/log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
 namespace kernel::pmm
 {
 namespace
 {
-    instance global_manager;
+    // one instance per NUMA node; without SRAT, everything lives in node 0
+    constexpr std::size_t max_node_count = 16;
+    instance node_managers[max_node_count];
+    std::uint32_t node_domains[max_node_count] = {};
+    std::size_t node_count = 1;
+
+    // SLIT, copied at initialization; the ACPI tables are released after boot, and walking them on every
+    // lookup would be slow anyway
+    constexpr std::size_t max_locality_count = 64;
+    std::uint8_t numa_distances[max_locality_count * max_locality_count];
+    std::size_t locality_count = 0;
+
+    // for each node, the list of all nodes, sorted by their SLIT distance from it
+    std::size_t node_fallback_order[max_node_count][max_node_count] = {};
+
+    constexpr std::size_t max_srat_range_count = 64;
+    acpi::srat_memory_range srat_ranges[max_srat_range_count];
+    std::size_t srat_range_count = 0;
+
+    phys_ptr_t<frame_metadata> frame_metadata_array{ nullptr };
+    std::size_t frame_metadata_count = 0;
+    phys_addr_t frame_metadata_start;
+    phys_addr_t frame_metadata_end;
+
     std::uintptr_t sub_1M_bottom = 0;
     std::uintptr_t sub_1M_top = 0;
 
-    std::size_t free_frames[arch::vm::page_size_count] = {};
-    std::size_t used_frames[arch::vm::page_size_count] = {};
+    std::atomic<std::size_t> free_frames[arch::vm::page_size_count];
+    std::atomic<std::size_t> used_frames[arch::vm::page_size_count];
+
+    std::atomic<bool> per_core_caches_enabled = false;
+
+    // memory that is only needed during boot, handed back to the PMM by reclaim_boot_memory()
+    constexpr std::size_t max_boot_range_count = 64;
+    std::pair<phys_addr_t, phys_addr_t> boot_ranges[max_boot_range_count];
+    std::size_t boot_range_count = 0;
+
+    std::size_t current_node()
+    {
+        if (!per_core_caches_enabled.load(std::memory_order_acquire))
+        {
+            return 0;
+        }
+
+        util::interrupt_guard guard;
+        return arch::cpu::get_current_core()->get_frame_cache()->get_node();
+    }
+
+    constexpr std::string_view memmap_type_to_description(boot_protocol::memory_type type)
+    {
+        switch (type)
+        {
+            case boot_protocol::memory_type::unusable:
+                return "unusable";
+            case boot_protocol::memory_type::free:
+                return "free";
+            case boot_protocol::memory_type::loader:
+                return "bootloader";
+            case boot_protocol::memory_type::preserve:
+                return "preserve for runtime";
+            case boot_protocol::memory_type::acpi_reclaimable:
+                return "ACPI-reclaimable";
+            case boot_protocol::memory_type::persistent:
+                return "presistent";
+
+            case boot_protocol::memory_type::kernel:
+                return "kernel";
+            case boot_protocol::memory_type::initrd:
+                return "initrd";
+            case boot_protocol::memory_type::paging:
+                return "paging structures";
+            case boot_protocol::memory_type::memory_map:
+                return "memory map";
+            case boot_protocol::memory_type::backbuffer:
+                return "video backbuffer";
+            case boot_protocol::memory_type::log_buffer:
+                return "boot log buffer";
+            case boot_protocol::memory_type::working_stack:
+                return "working stack";
+
+            default:
+                return "!! INVALID !!";
+        }
+    }
+
+    std::uint8_t numa_distance(std::uint32_t from_domain, std::uint32_t to_domain)
+    {
+        // values as defined by the ACPI specification for the local and a generic remote domain
+        constexpr std::uint8_t local_distance = 10;
+        constexpr std::uint8_t remote_distance = 20;
+
+        if (from_domain >= locality_count || to_domain >= locality_count)
+        {
+            return from_domain == to_domain ? local_distance : remote_distance;
+        }
+
+        return numa_distances[from_domain * locality_count + to_domain];
+    }
+
+    std::size_t node_for_domain(std::uint32_t domain)
+    {
+        std::size_t nearest = 0;
+
+        for (std::size_t i = 0; i < node_count; ++i)
+        {
+            if (node_domains[i] == domain)
+            {
+                return i;
+            }
+
+            if (numa_distance(domain, node_domains[i]) < numa_distance(domain, node_domains[nearest]))
+            {
+                nearest = i;
+            }
+        }
+
+        // domains without memory of their own (e.g. CPU-only ones) are served by the closest node
+        return nearest;
+    }
+
+    // returns the node that owns the memory at `start`, and the end of the longest range starting at `start`
+    // and ending no later than `end` that is owned by that node
+    std::pair<std::size_t, phys_addr_t> node_for_range(phys_addr_t start, phys_addr_t end)
+    {
+        auto range_end = end;
+
+        for (std::size_t i = 0; i < srat_range_count; ++i)
+        {
+            auto srat_start = srat_ranges[i].base;
+            auto srat_end = srat_ranges[i].base + srat_ranges[i].length;
+
+            if (srat_start <= start && start < srat_end)
+            {
+                return { node_for_domain(srat_ranges[i].proximity_domain), srat_end < end ? srat_end : end };
+            }
+
+            if (start < srat_start && srat_start < range_end)
+            {
+                range_end = srat_start;
+            }
+        }
+
+        return { 0, range_end };
+    }
+
+    std::size_t node_for_frame(phys_addr_t frame)
+    {
+        for (std::size_t i = 0; i < node_count; ++i)
+        {
+            if (node_managers[i].owns(frame))
+            {
+                return i;
+            }
+        }
+
+        // frames outside of any region, like reclaimed boot memory, still belong to the node that SRAT
+        // assigns them to
+        return node_for_range(frame, frame + arch::vm::page_sizes[0]).first;
+    }
+
+    void pop_from_nodes(std::size_t node, std::size_t page_layer, phys_addr_t * frames, std::size_t count)
+    {
+        std::size_t popped = 0;
+
+        auto pop_from_all = [&]
+        {
+            for (std::size_t i = 0; i < node_count && popped < count; ++i)
+            {
+                popped += node_managers[node_fallback_order[node][i]].pop_batch(
+                    page_layer, frames + popped, count - popped);
+            }
+        };
+
+        pop_from_all();
+
+        // the caches of the cores can still hold frames; the ones that are busy (including the one of this
+        // core, if this is its refill) are skipped, as their owners may be waiting for locks held here
+        if (popped != count && per_core_caches_enabled.load(std::memory_order_acquire))
+        {
+            for (std::size_t i = 0; i < arch::cpu::get_core_count(); ++i)
+            {
+                arch::cpu::get_core_by_id(i)->get_frame_cache()->try_drain();
+            }
+
+            pop_from_all();
+        }
+
+        if (popped != count)
+        {
+            PANIC("Out of physical memory for frames of size {}!", arch::vm::page_sizes[page_layer]);
+        }
+    }
+
+    void push_to_nodes(std::size_t page_layer, const phys_addr_t * frames, std::size_t count)
+    {
+        while (count)
+        {
+            auto node = node_for_frame(frames[0]);
+
+            std::size_t run = 1;
+            while (run < count && node_for_frame(frames[run]) == node)
+            {
+                ++run;
+            }
+
+            node_managers[node].push_batch(page_layer, frames, run);
+            frames += run;
+            count -= run;
+        }
+    }
+
+    void initialize_nodes()
+    {
+        srat_range_count = acpi::parse_srat_memory(srat_ranges, max_srat_range_count);
+        locality_count = acpi::copy_numa_distances(numa_distances, max_locality_count);
+
+        if (srat_range_count)
+        {
+            node_count = 0;
+        }
+
+        for (std::size_t i = 0; i < srat_range_count; ++i)
+        {
+            auto domain = srat_ranges[i].proximity_domain;
+
+            if (std::find(node_domains, node_domains + node_count, domain) != node_domains + node_count)
+            {
+                continue;
+            }
+
+            if (node_count == max_node_count)
+            {
+                log::println(
+                    " > Warning: too many NUMA domains, domain {} will be merged into others.", domain);
+                continue;
+            }
+
+            node_domains[node_count++] = domain;
+        }
+
+        for (std::size_t i = 0; i < node_count; ++i)
+        {
+            auto & order = node_fallback_order[i];
+
+            for (std::size_t j = 0; j < node_count; ++j)
+            {
+                order[j] = j;
+            }
+
+            // insertion sort by distance; stable, so equally distant nodes stay in index order
+            for (std::size_t j = 1; j < node_count; ++j)
+            {
+                auto distance = numa_distance(node_domains[i], node_domains[order[j]]);
+                for (std::size_t k = j;
+                     k > 0 && numa_distance(node_domains[i], node_domains[order[k - 1]]) > distance;
+                     --k)
+                {
+                    std::swap(order[k], order[k - 1]);
+                }
+            }
+        }
+
+        log::println(" > NUMA nodes: {}.", node_count);
+    }
+
+    void add_free_range(phys_addr_t start, phys_addr_t end)
+    {
+        // the frame metadata array is carved out of free memory, so it needs to be skipped here
+        if (start < frame_metadata_end && frame_metadata_start < end)
+        {
+            if (start < frame_metadata_start)
+            {
+                add_free_range(start, frame_metadata_start);
+            }
+
+            if (frame_metadata_end < end)
+            {
+                add_free_range(frame_metadata_end, end);
+            }
+
+            return;
+        }
+
+        while (start < end)
+        {
+            auto [node, node_end] = node_for_range(start, end);
+            node_managers[node].add_region(start, node_end);
+            start = node_end;
+        }
+    }
+
+    void add_boot_range(phys_addr_t start, phys_addr_t end)
+    {
+        // the first MiB is kept aside for things like AP startup trampolines, and is never reclaimed
+        auto low_memory_end = phys_addr_t{ 1024 * 1024 };
+        if (start < low_memory_end)
+        {
+            start = low_memory_end;
+        }
+
+        if (start >= end)
+        {
+            return;
+        }
+
+        if (boot_range_count == max_boot_range_count)
+        {
+            log::println(
+                " > Warning: too many boot memory ranges, {:#018x} - {:#018x} will not be reclaimed.",
+                start.value(),
+                end.value());
+            return;
+        }
+
+        boot_ranges[boot_range_count++] = { start, end };
+    }
+
+    void reclaim_range(phys_addr_t start, phys_addr_t end)
+    {
+        used_frames[0].fetch_sub(
+            (end.value() - start.value()) / arch::vm::page_sizes[0], std::memory_order_relaxed);
+
+        while (start < end)
+        {
+            auto [node, node_end] = node_for_range(start, end);
+            node_managers[node].add_frames(start, node_end);
+            start = node_end;
+        }
+    }
+
+    bool is_managed_memory(boot_protocol::memory_type type)
+    {
+        switch (type)
+        {
+            case boot_protocol::memory_type::free:
+            case boot_protocol::memory_type::loader:
+            case boot_protocol::memory_type::acpi_reclaimable:
+            case boot_protocol::memory_type::kernel:
+            case boot_protocol::memory_type::initrd:
+            case boot_protocol::memory_type::paging:
+            case boot_protocol::memory_type::memory_map:
+            case boot_protocol::memory_type::backbuffer:
+            case boot_protocol::memory_type::log_buffer:
+            case boot_protocol::memory_type::working_stack:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    void initialize_frame_metadata(std::size_t memmap_size, boot_protocol::memory_map_entry * memmap)
+    {
+        std::uintptr_t top = 0;
+        for (auto i = 0ull; i < memmap_size; ++i)
+        {
+            if (is_managed_memory(memmap[i].type) && memmap[i].physical_start + memmap[i].length > top)
+            {
+                top = memmap[i].physical_start + memmap[i].length;
+            }
+        }
+
+        frame_metadata_count = top / arch::vm::page_sizes[0];
+        auto size = frame_metadata_count * sizeof(frame_metadata);
+        size = (size + arch::vm::page_sizes[0] - 1) & ~(arch::vm::page_sizes[0] - 1);
+
+        // take the space from the end of the largest free entry
+        boot_protocol::memory_map_entry * best = nullptr;
+        for (auto i = 0ull; i < memmap_size; ++i)
+        {
+            if (memmap[i].type == boot_protocol::memory_type::free && memmap[i].physical_start >= 1024 * 1024
+                && memmap[i].length >= size && (!best || memmap[i].length > best->length))
+            {
+                best = &memmap[i];
+            }
+        }
+
+        if (!best)
+        {
+            PANIC("Failed to find {} bytes of free memory for the frame metadata array!", size);
+        }
+
+        frame_metadata_end = phys_addr_t{ best->physical_start + best->length };
+        frame_metadata_start = frame_metadata_end - size;
+        frame_metadata_array = phys_ptr_t<frame_metadata>{ frame_metadata_start };
+
+        used_frames[0].fetch_add(size / arch::vm::page_sizes[0], std::memory_order_relaxed);
+
+        log::println(
+            " > Frame metadata array: {} entries at {:#018x}.",
+            frame_metadata_count,
+            frame_metadata_start.value());
+    }
+
+    // Frames can be freed without ever having been handed out by the PMM, like the page tables of the loader
+    // or reclaimed boot memory, so the entries of all frames need to be unreferenced before they can reach
+    // the PMM. Clearing the whole array at once would make initialization linear in the size of memory, so
+    // it is done for each range as it enters the PMM instead, including the lazily carved ones.
+    void clear_frame_metadata(phys_addr_t start, phys_addr_t end)
+    {
+        auto first = start.value() / arch::vm::page_sizes[0];
+        auto last = (end.value() + arch::vm::page_sizes[0] - 1) / arch::vm::page_sizes[0];
+        last = last < frame_metadata_count ? last : frame_metadata_count;
+
+        if (first < last)
+        {
+            std::memset(frame_metadata_array.value() + first, 0, (last - first) * sizeof(frame_metadata));
+        }
+    }
+
+    void initialize_metadata(std::size_t page_layer, const phys_addr_t * frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto metadata = get_frame_metadata(frames[i]);
+            metadata->refcount.store(1, std::memory_order_relaxed);
+            metadata->page_layer = page_layer;
+            metadata->flags = frame_flags::none;
+            metadata->owner = nullptr;
+        }
+    }
+
+    void finalize_metadata(const phys_addr_t * frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto metadata = get_frame_metadata(frames[i]);
+            if (metadata->refcount.load(std::memory_order_relaxed) > 1)
+            {
+                PANIC("Tried to free frame {:#018x}, which is still referenced!", frames[i].value());
+            }
+
+            metadata->refcount.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void instance::add_region(phys_addr_t start, phys_addr_t end)
+{
+    // with no region slots left, the frames are still usable, just without coalescing and contiguous
+    // allocations
+    if (_region_count == _max_regions)
+    {
+        add_frames(start, end);
+        return;
+    }
+
+    constexpr auto top_layer = arch::vm::page_size_count - 1;
+    constexpr auto top_size = arch::vm::page_sizes[top_layer];
+
+    auto anchor = phys_addr_t{ start.value() & ~(top_size - 1) };
+
+    std::size_t bitmap_words[arch::vm::page_size_count];
+    std::size_t bitmap_bytes = 0;
+    for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
+    {
+        bitmap_words[i] = _bitmap_words(anchor, end, i);
+        bitmap_bytes += bitmap_words[i] * sizeof(std::uint64_t);
+    }
+
+    bitmap_bytes = (bitmap_bytes + arch::vm::page_sizes[0] - 1) & ~(arch::vm::page_sizes[0] - 1);
+    if (bitmap_bytes >= end.value() - start.value())
+    {
+        // too small to be worth the bitmaps
+        add_frames(start, end);
+        return;
+    }
+
+    used_frames[0].fetch_add(bitmap_bytes / arch::vm::page_sizes[0], std::memory_order_relaxed);
+
+    auto position = _region_count;
+    while (position > 0 && _regions[position - 1].start > start)
+    {
+        _regions[position] = _regions[position - 1];
+        --position;
+    }
+    ++_region_count;
+
+    auto & region = _regions[position];
+    region.anchor = anchor;
+    region.start = start;
+    region.end = end;
+
+    auto bitmap = phys_ptr_t<std::uint64_t>{ start };
+    for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
+    {
+        region.bitmaps[i] = bitmap;
+        bitmap = bitmap + bitmap_words[i];
+    }
+
+    start += bitmap_bytes;
+
+    // the aligned middle of the region is kept as a range of largest frames that are only carved out (and
+    // have their headers and bitmaps written) once they are needed; this keeps the cost of initialization
+    // independent of the amount of memory
+    region.lazy_start = phys_addr_t{ (start.value() + top_size - 1) & ~(top_size - 1) };
+    region.lazy_end = phys_addr_t{ end.value() & ~(top_size - 1) };
+    if (region.lazy_start >= region.lazy_end)
+    {
+        region.lazy_start = end;
+        region.lazy_end = end;
+    }
+
+    std::memset(region.bitmaps[top_layer].value(), 0, bitmap_words[top_layer] * sizeof(std::uint64_t));
+    _clear_lower_bitmaps(&region, anchor);
+    _clear_lower_bitmaps(&region, phys_addr_t{ (end.value() - 1) & ~(top_size - 1) });
+
+    free_frames[top_layer].fetch_add(
+        (region.lazy_end.value() - region.lazy_start.value()) / top_size, std::memory_order_relaxed);
+
+    if (region.lazy_start == region.lazy_end)
+    {
+        _push_range(start, end);
+    }
+
+    else
+    {
+        _push_range(start, region.lazy_start);
+        _push_range(region.lazy_end, end);
+    }
+}
+
+void instance::push(std::size_t page_layer, phys_addr_t frame)
+{
+    auto & stack_info = _infos[page_layer];
+    std::lock_guard lock(stack_info.lock);
+
+    _push_locked(page_layer, stack_info, frame);
+}
+
+void instance::add_frames(phys_addr_t start, phys_addr_t end)
+{
+    _push_range(start, end);
+}
+
+bool instance::owns(phys_addr_t frame)
+{
+    return _find_region(frame);
+}
+
+std::optional<phys_addr_t> instance::pop(std::size_t page_layer)
+{
+    auto & stack_info = _infos[page_layer];
+    std::lock_guard lock(stack_info.lock);
+
+    return _pop_locked(page_layer, stack_info);
+}
+
+void instance::push_batch(std::size_t page_layer, const phys_addr_t * frames, std::size_t count)
+{
+    auto & stack_info = _infos[page_layer];
+    std::lock_guard lock(stack_info.lock);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        _push_locked(page_layer, stack_info, frames[i]);
+    }
+}
+
+std::size_t instance::pop_batch(std::size_t page_layer, phys_addr_t * frames, std::size_t count)
+{
+    auto & stack_info = _infos[page_layer];
+    std::lock_guard lock(stack_info.lock);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto frame = _pop_locked(page_layer, stack_info);
+        if (!frame)
+        {
+            // as a last resort, take back frames that were zeroed ahead of time
+            if (page_layer == 0)
+            {
+                return i + pop_zeroed_batch(frames + i, count - i);
+            }
+
+            return i;
+        }
+
+        frames[i] = *frame;
+    }
+
+    return count;
+}
+
+std::size_t instance::pop_zeroed_batch(phys_addr_t * frames, std::size_t count)
+{
+    std::lock_guard lock(_zeroed.lock);
+
+    std::size_t popped = 0;
+    while (popped < count && _zeroed.num_frames)
+    {
+        auto frame = _zeroed.stack.representation();
+        _unlink_locked(_zeroed, frame);
+
+        // the header was the only part of the frame written to after it has been zeroed
+        *phys_ptr_t<_frame_header>{ frame } = {};
+
+        frames[popped++] = frame;
+    }
+
+    return popped;
+}
+
+bool instance::refill_zeroed()
+{
+    {
+        std::lock_guard lock(_zeroed.lock);
+        if (_zeroed.num_frames >= _zeroed_pool_size)
+        {
+            return false;
+        }
+    }
+
+    auto frame = pop(0);
+    if (!frame)
+    {
+        return false;
+    }
+
+    std::memset(phys_ptr_t<char>{ *frame }.value(), 0, arch::vm::page_sizes[0]);
+
+    std::lock_guard lock(_zeroed.lock);
+    _link_locked(_zeroed, *frame);
+    return true;
+}
+
+std::size_t instance::_bitmap_words(phys_addr_t anchor, phys_addr_t end, std::size_t page_layer)
+{
+    auto page_size = arch::vm::page_sizes[page_layer];
+    auto blocks = (end.value() - anchor.value() + page_size - 1) / page_size;
+    return (blocks + 63) / 64;
+}
+
+void instance::_clear_lower_bitmaps(_region * region, phys_addr_t block)
+{
+    constexpr auto top_size = arch::vm::page_sizes[arch::vm::page_size_count - 1];
+
+    for (std::size_t i = 0; i < arch::vm::page_size_count - 1; ++i)
+    {
+        static_assert((top_size / arch::vm::page_sizes[0]) % 64 == 0);
+
+        auto first_word = (block.value() - region->anchor.value()) / arch::vm::page_sizes[i] / 64;
+        auto last_word = first_word + top_size / arch::vm::page_sizes[i] / 64;
+        auto limit = _bitmap_words(region->anchor, region->end, i);
+        last_word = last_word < limit ? last_word : limit;
+
+        std::memset(
+            region->bitmaps[i].value() + first_word, 0, (last_word - first_word) * sizeof(std::uint64_t));
+    }
+}
+
+bool instance::_carve_locked(_stack_info & stack_info)
+{
+    constexpr auto top_layer = arch::vm::page_size_count - 1;
+
+    for (std::size_t i = 0; i < _region_count; ++i)
+    {
+        auto & region = _regions[i];
+        if (region.lazy_start == region.lazy_end)
+        {
+            continue;
+        }
+
+        _carve_block_locked(stack_info, region);
+        return true;
+    }
+
+    return false;
+}
+
+void instance::_carve_block_locked(_stack_info & stack_info, _region & region)
+{
+    constexpr auto top_layer = arch::vm::page_size_count - 1;
+
+    auto block = region.lazy_start;
+    region.lazy_start += arch::vm::page_sizes[top_layer];
+
+    clear_frame_metadata(block, block + arch::vm::page_sizes[top_layer]);
+
+    // no frames of this block can be on the stacks of lower layers yet, so nothing else looks at these
+    // bits, and they can be cleared without holding the locks of those layers
+    _clear_lower_bitmaps(&region, block);
+
+    _link_locked(stack_info, block);
+    _set_free_bit(&region, top_layer, block, true);
+}
+
+void instance::_push_range(phys_addr_t start, phys_addr_t end)
+{
+    clear_frame_metadata(start, end);
+
+    auto remaining = end.value() - start.value();
+
+    auto push_one = [&](std::size_t i)
+    {
+        push(i, start);
+        start += arch::vm::page_sizes[i];
+        remaining -= arch::vm::page_sizes[i];
+        free_frames[i].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    for (std::size_t i = 0; i < arch::vm::page_size_count - 1; ++i)
+    {
+        while (start % arch::vm::page_sizes[i + 1] && remaining >= arch::vm::page_sizes[i])
+        {
+            push_one(i);
+        }
+    }
+
+    for (std::size_t i = arch::vm::page_size_count; i > 0; --i)
+    {
+        while (remaining >= arch::vm::page_sizes[i - 1])
+        {
+            push_one(i - 1);
+        }
+    }
+}
+
+instance::_region * instance::_find_region(phys_addr_t frame)
+{
+    std::size_t begin = 0;
+    std::size_t end = _region_count;
+
+    while (begin < end)
+    {
+        auto middle = begin + (end - begin) / 2;
+        auto & region = _regions[middle];
+
+        if (frame < region.start)
+        {
+            end = middle;
+        }
+        else if (frame >= region.end)
+        {
+            begin = middle + 1;
+        }
+        else
+        {
+            return &region;
+        }
+    }
+
+    return nullptr;
+}
+
+void instance::_set_free_bit(_region * region, std::size_t page_layer, phys_addr_t frame, bool value)
+{
+    auto index = (frame.value() - region->anchor.value()) / arch::vm::page_sizes[page_layer];
+    auto & word = region->bitmaps[page_layer].value()[index / 64];
+
+    if (value)
+    {
+        word |= 1ull << (index % 64);
+    }
+    else
+    {
+        word &= ~(1ull << (index % 64));
+    }
+}
+
+bool instance::_get_free_bit(_region * region, std::size_t page_layer, phys_addr_t frame)
+{
+    auto index = (frame.value() - region->anchor.value()) / arch::vm::page_sizes[page_layer];
+    return region->bitmaps[page_layer].value()[index / 64] & (1ull << (index % 64));
+}
+
+std::optional<phys_addr_t> instance::_free_block_end(_region * region, phys_addr_t frame)
+{
+    if (region->lazy_start <= frame && frame < region->lazy_end)
+    {
+        return region->lazy_end;
+    }
+
+    for (std::size_t i = arch::vm::page_size_count; i > 0; --i)
+    {
+        auto block = phys_addr_t{ frame.value() & ~(arch::vm::page_sizes[i - 1] - 1) };
+        if (_get_free_bit(region, i - 1, block))
+        {
+            return block + arch::vm::page_sizes[i - 1];
+        }
+    }
+
+    return std::nullopt;
+}
+
+void instance::_link_locked(_stack_info & stack_info, phys_addr_t frame)
+{
+    auto frame_header = phys_ptr_t<_frame_header>{ frame };
+    frame_header->prev = phys_ptr_t<_frame_header>{ nullptr };
+    frame_header->next = stack_info.stack;
+    if (stack_info.stack)
+    {
+        stack_info.stack->prev = frame_header;
+    }
+    stack_info.stack = frame_header;
+    ++stack_info.num_frames;
+}
+
+void instance::_unlink_locked(_stack_info & stack_info, phys_addr_t frame)
+{
+    auto frame_header = phys_ptr_t<_frame_header>{ frame };
+
+    if (frame_header->prev)
+    {
+        frame_header->prev->next = frame_header->next;
+    }
+    else
+    {
+        stack_info.stack = frame_header->next;
+    }
+
+    if (frame_header->next)
+    {
+        frame_header->next->prev = frame_header->prev;
+    }
+
+    --stack_info.num_frames;
+}
+
+void instance::_push_locked(std::size_t page_layer, _stack_info & stack_info, phys_addr_t frame)
+{
+    _link_locked(stack_info, frame);
+
+    auto region = _find_region(frame);
+    if (!region)
+    {
+        return;
+    }
+
+    _set_free_bit(region, page_layer, frame, true);
+
+    if (page_layer == arch::vm::page_size_count - 1)
+    {
+        return;
+    }
+
+    // check whether all the blocks that together make up the containing block of the higher layer are free
+    // now; if so, take them off this layer and hand the containing block to the higher layer instead
+    constexpr auto group_size = arch::vm::page_sizes[1] / arch::vm::page_sizes[0];
+    static_assert(group_size % 64 == 0);
+    static_assert(arch::vm::page_sizes[2] / arch::vm::page_sizes[1] == group_size);
+
+    // blocks at the edges of the region whose containing block reaches outside of it can never be coalesced;
+    // the bitmap of the region also doesn't extend to the end of such a containing block
+    auto group_base = phys_addr_t{ frame.value() & ~(arch::vm::page_sizes[page_layer + 1] - 1) };
+    if (group_base < region->start || region->end < group_base + arch::vm::page_sizes[page_layer + 1])
+    {
+        return;
+    }
+
+    auto index = (frame.value() - region->anchor.value()) / arch::vm::page_sizes[page_layer];
+    auto first_word = (index / group_size) * (group_size / 64);
+    if (first_word + group_size / 64 > _bitmap_words(region->anchor, region->end, page_layer))
+    {
+        return;
+    }
+
+    auto group_words = region->bitmaps[page_layer].value() + first_word;
+
+    for (std::size_t i = 0; i < group_size / 64; ++i)
+    {
+        if (group_words[i] != ~0ull)
+        {
+            return;
+        }
+    }
+
+    for (std::size_t i = 0; i < group_size; ++i)
+    {
+        _unlink_locked(stack_info, group_base + i * arch::vm::page_sizes[page_layer]);
+    }
+
+    for (std::size_t i = 0; i < group_size / 64; ++i)
+    {
+        group_words[i] = 0;
+    }
+
+    free_frames[page_layer].fetch_sub(group_size, std::memory_order_relaxed);
+    free_frames[page_layer + 1].fetch_add(1, std::memory_order_relaxed);
+
+    // locks are always taken from the smaller layers to the larger ones, so this can't deadlock
+    push(page_layer + 1, group_base);
+}
+
+std::optional<phys_addr_t> instance::_pop_locked(std::size_t page_layer, _stack_info & stack_info)
+{
+    if (stack_info.num_frames == 0)
+    {
+        // running out of memory in this instance is handled by the caller, by falling back to other nodes
+        if (page_layer == arch::vm::page_size_count - 1)
+        {
+            if (!_carve_locked(stack_info))
+            {
+                return std::nullopt;
+            }
+
+            return _pop_locked(page_layer, stack_info);
+        }
+
+        auto higher_layer_frame_opt = pop(page_layer + 1);
+        if (!higher_layer_frame_opt)
+        {
+            return std::nullopt;
+        }
+
+        // the lock of this layer is already held, so the split frames are linked in directly; this also
+        // skips the coalescing check, which would otherwise immediately merge them back
+        auto higher_layer_frame = *higher_layer_frame_opt;
+        auto region = _find_region(higher_layer_frame);
+        auto split_count = arch::vm::page_sizes[page_layer + 1] / arch::vm::page_sizes[page_layer];
+        for (std::size_t i = 0; i < split_count; ++i)
+        {
+            auto frame = higher_layer_frame + i * arch::vm::page_sizes[page_layer];
+            _link_locked(stack_info, frame);
+            if (region)
+            {
+                _set_free_bit(region, page_layer, frame, true);
+            }
+        }
+
+        free_frames[page_layer + 1].fetch_sub(1, std::memory_order_relaxed);
+        free_frames[page_layer].fetch_add(split_count, std::memory_order_relaxed);
+    }
+
+    auto ret = stack_info.stack.representation();
+    _unlink_locked(stack_info, ret);
+
+    if (auto region = _find_region(ret))
+    {
+        _set_free_bit(region, page_layer, ret, false);
+    }
+
+    return ret;
+}
+
+void instance::_link_range_locked(_region * region, phys_addr_t start, phys_addr_t end)
+{
+    while (start < end)
+    {
+        auto page_layer = arch::vm::page_size_count - 1;
+        while (start % arch::vm::page_sizes[page_layer]
+               || end.value() - start.value() < arch::vm::page_sizes[page_layer])
+        {
+            --page_layer;
+        }
+
+        _link_locked(_infos[page_layer], start);
+        _set_free_bit(region, page_layer, start, true);
+        free_frames[page_layer].fetch_add(1, std::memory_order_relaxed);
+
+        start += arch::vm::page_sizes[page_layer];
+    }
+}
+
+void instance::_take_range_locked(_region * region, phys_addr_t start, phys_addr_t end)
+{
+    constexpr auto top_layer = arch::vm::page_size_count - 1;
+
+    // the lazily carved blocks have no headers yet, so the ones overlapping the range need to be carved first
+    while (region->lazy_start < region->lazy_end && region->lazy_start < end)
+    {
+        _carve_block_locked(_infos[top_layer], *region);
+    }
+
+    auto position = start;
+    while (position < end)
+    {
+        auto page_layer = top_layer;
+        auto block = phys_addr_t{ position.value() & ~(arch::vm::page_sizes[page_layer] - 1) };
+        while (!_get_free_bit(region, page_layer, block))
+        {
+            --page_layer;
+            block = phys_addr_t{ position.value() & ~(arch::vm::page_sizes[page_layer] - 1) };
+        }
+
+        auto block_end = block + arch::vm::page_sizes[page_layer];
+
+        _unlink_locked(_infos[page_layer], block);
+        _set_free_bit(region, page_layer, block, false);
+        free_frames[page_layer].fetch_sub(1, std::memory_order_relaxed);
+
+        // the parts of the block outside of the range go back as smaller frames; they are not coalesced,
+        // since the block they belong to is now partially used
+        _link_range_locked(region, block, position);
+        _link_range_locked(region, end < block_end ? end : block_end, block_end);
+
+        position = block_end;
+    }
+}
+
+std::optional<phys_addr_t> instance::allocate_contiguous(
+    std::size_t frame_count,
+    std::size_t alignment,
+    phys_addr_t limit)
+{
+    auto size = frame_count * arch::vm::page_sizes[0];
+    auto align_up = [&](phys_addr_t address)
+    {
+        return phys_addr_t{ (address.value() + alignment - 1) & ~(alignment - 1) };
+    };
+
+    // the search needs a consistent view of the bitmaps of all layers; the locks are taken from the smallest
+    // layer to the largest, like everywhere else
+    for (auto & stack_info : _infos)
+    {
+        stack_info.lock.lock();
+    }
+
+    std::optional<phys_addr_t> ret;
+
+    for (std::size_t i = 0; i < _region_count && !ret; ++i)
+    {
+        auto region = &_regions[i];
+        auto end = region->end < limit ? region->end : limit;
+
+        auto candidate = align_up(region->start);
+        while (candidate < end && end.value() - candidate.value() >= size)
+        {
+            // skip over whole free blocks at a time; on the first frame that isn't free, restart the search
+            // at the next aligned address past it
+            auto position = candidate;
+            while (position < candidate + size)
+            {
+                auto block_end = _free_block_end(region, position);
+                if (!block_end)
+                {
+                    break;
+                }
 
-    constexpr std::string_view memmap_type_to_description(boot_protocol::memory_type type)
+                position = *block_end;
+            }
+
+            if (position >= candidate + size)
+            {
+                _take_range_locked(region, candidate, candidate + size);
+                ret = candidate;
+                break;
+            }
+
+            candidate = align_up(position + arch::vm::page_sizes[0]);
+        }
+    }
+
+    for (std::size_t i = arch::vm::page_size_count; i > 0; --i)
     {
-        switch (type)
+        _infos[i - 1].lock.unlock();
+    }
+
+    return ret;
+}
+
+void instance::add_fragmentation(fragmentation_info & info)
+{
+    constexpr auto group_words = arch::vm::page_sizes[1] / arch::vm::page_sizes[0] / 64;
+
+    for (std::size_t page_layer = 0; page_layer < arch::vm::page_size_count - 1; ++page_layer)
+    {
+        std::lock_guard lock(_infos[page_layer].lock);
+
+        for (std::size_t i = 0; i < _region_count; ++i)
         {
-            case boot_protocol::memory_type::unusable:
-                return "unusable";
-            case boot_protocol::memory_type::free:
-                return "free";
-            case boot_protocol::memory_type::loader:
-                return "bootloader";
-            case boot_protocol::memory_type::preserve:
-                return "preserve for runtime";
-            case boot_protocol::memory_type::acpi_reclaimable:
-                return "ACPI-reclaimable";
-            case boot_protocol::memory_type::persistent:
-                return "presistent";
+            auto & region = _regions[i];
+            auto words = _bitmap_words(region.anchor, region.end, page_layer);
+            auto bitmap = region.bitmaps[page_layer].value();
 
-            case boot_protocol::memory_type::kernel:
-                return "kernel";
-            case boot_protocol::memory_type::initrd:
-                return "initrd";
-            case boot_protocol::memory_type::paging:
-                return "paging structures";
-            case boot_protocol::memory_type::memory_map:
-                return "memory map";
-            case boot_protocol::memory_type::backbuffer:
-                return "video backbuffer";
-            case boot_protocol::memory_type::log_buffer:
-                return "boot log buffer";
-            case boot_protocol::memory_type::working_stack:
-                return "working stack";
+            // groups of blocks that are wholly free have been coalesced, so any free block left in a group
+            // means that the group is only partially free
+            for (std::size_t first = 0; first < words; first += group_words)
+            {
+                std::size_t free_blocks = 0;
+                for (std::size_t word = first; word < first + group_words && word < words; ++word)
+                {
+                    free_blocks += __builtin_popcountll(bitmap[word]);
+                }
 
-            default:
-                return "!! INVALID !!";
+                info.region_frames[page_layer] += free_blocks;
+                info.partial_blocks[page_layer] += free_blocks != 0;
+            }
         }
     }
 }
 
-void instance::push(std::size_t page_layer, phys_addr_t frame)
+void frame_cache::pop_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count)
 {
-    auto & stack_info = _infos[page_layer];
-    std::lock_guard lock(stack_info.lock);
+    std::lock_guard _(_lock);
 
-    auto frame_header = phys_ptr_t<_frame_header>{ frame };
-    frame_header->next = stack_info.stack;
-    stack_info.stack = frame_header;
-    ++stack_info.num_frames;
+    // batches larger than a refill already amortize the locking on their own
+    if (page_layer >= cached_layers || count > _capacities[page_layer] / 2)
+    {
+        pop_from_nodes(_node, page_layer, frames, count);
+        return;
+    }
+
+    auto & magazine = _magazines[page_layer];
+
+    if (magazine.count < count)
+    {
+        auto refill_count = _capacities[page_layer] / 2;
+        pop_from_nodes(_node, page_layer, magazine.frames + magazine.count, refill_count);
+        magazine.count += refill_count;
+    }
+
+    magazine.count -= count;
+    std::memcpy(frames, magazine.frames + magazine.count, count * sizeof(phys_addr_t));
 }
 
-phys_addr_t instance::pop(std::size_t page_layer)
+void frame_cache::push_n(std::size_t page_layer, const phys_addr_t * frames, std::size_t count)
 {
-    auto & stack_info = _infos[page_layer];
-    std::lock_guard lock(stack_info.lock);
+    std::lock_guard _(_lock);
 
-    if (stack_info.num_frames == 0)
+    if (page_layer >= cached_layers || count > _capacities[page_layer] / 2)
     {
-        if (page_layer == arch::vm::page_size_count - 1)
-        {
-            PANIC("...and now implement cross-pmm-instance rebalancing");
-        }
+        push_to_nodes(page_layer, frames, count);
+        return;
+    }
 
-        auto higher_layer_frame = pop(page_layer + 1);
-        for (std::size_t i = 0; i < arch::vm::page_sizes[page_layer + 1] / arch::vm::page_sizes[page_layer];
-             ++i)
-        {
-            pmm::push(page_layer, higher_layer_frame + i * arch::vm::page_sizes[page_layer]);
-        }
+    auto & magazine = _magazines[page_layer];
+
+    if (magazine.count + count > _capacities[page_layer])
+    {
+        auto drain_count = _capacities[page_layer] / 2;
+        magazine.count -= drain_count;
+        push_to_nodes(page_layer, magazine.frames + magazine.count, drain_count);
     }
 
-    auto ret = stack_info.stack;
-    stack_info.stack = ret->next;
-    --stack_info.num_frames;
-    return ret.representation();
+    std::memcpy(magazine.frames + magazine.count, frames, count * sizeof(phys_addr_t));
+    magazine.count += count;
+}
+
+void frame_cache::try_drain()
+{
+    if (!_lock.try_lock())
+    {
+        return;
+    }
+
+    std::lock_guard _(_lock, std::adopt_lock);
+
+    for (std::size_t page_layer = 0; page_layer < cached_layers; ++page_layer)
+    {
+        auto & magazine = _magazines[page_layer];
+        push_to_nodes(page_layer, magazine.frames, magazine.count);
+        magazine.count = 0;
+    }
 }
 
 void initialize(std::size_t memmap_size, boot_protocol::memory_map_entry * memmap)
 {
+    auto initialization_start = arch::cpu::get_timestamp_counter();
+
     log::println("[PMM] Initializing physical memory manager...");
     log::println(" > Memory map location: {}, size: {}.", memmap, memmap_size);
+    initialize_nodes();
+    initialize_frame_metadata(memmap_size, memmap);
+
     log::println(" > Memory map:");
 
     log::println("| {:-^18} | {:-^16} | {:-^20} |", "", "", "");
@@ -148,46 +1225,33 @@ void initialize(std::size_t memmap_size, boot_protocol::memory_map_entry * memma
 
         if (memmap[i].type == boot_protocol::memory_type::free)
         {
-            auto remaining = size;
-
-            auto push = [&](std::size_t i)
-            {
-                global_manager.push(i, start);
-                start += arch::vm::page_sizes[i];
-                remaining -= arch::vm::page_sizes[i];
-                ++free_frames[i];
-            };
-
-            for (std::size_t i = 0; i < arch::vm::page_size_count - 1; ++i)
-            {
-                while (start % arch::vm::page_sizes[i + 1] && remaining >= arch::vm::page_sizes[i])
-                {
-                    push(i);
-                }
-            }
-
-            for (std::size_t i = arch::vm::page_size_count; i > 0; --i)
-            {
-                while (remaining >= arch::vm::page_sizes[i - 1])
-                {
-                    push(i - 1);
-                }
-            }
+            add_free_range(start, start + size);
         }
 
         else
         {
+            if (is_managed_memory(memmap[i].type))
+            {
+                clear_frame_metadata(start, start + size);
+            }
+
             switch (memmap[i].type)
             {
+                // these are dead once the kernel has handed off control to bootinit; the initrd is used by
+                // bootinit itself, and is reclaimed once it lets go of it
                 case boot_protocol::memory_type::loader:
+                case boot_protocol::memory_type::memory_map:
+                case boot_protocol::memory_type::working_stack:
+                case boot_protocol::memory_type::acpi_reclaimable:
+                    add_boot_range(start, start + size);
+                    [[fallthrough]];
+
                 case boot_protocol::memory_type::kernel:
                 case boot_protocol::memory_type::initrd:
                 case boot_protocol::memory_type::paging:
-                case boot_protocol::memory_type::memory_map:
                 case boot_protocol::memory_type::backbuffer:
                 case boot_protocol::memory_type::log_buffer:
-                case boot_protocol::memory_type::working_stack:
-                    used_frames[0] += memmap[i].length / arch::vm::page_sizes[0];
+                    used_frames[0].fetch_add(size / arch::vm::page_sizes[0], std::memory_order_relaxed);
                     break;
 
                 default:;
@@ -196,6 +1260,20 @@ void initialize(std::size_t memmap_size, boot_protocol::memory_map_entry * memma
     }
 
     log::println("| {:-^18} | {:-^16} | {:-^20} |", "", "", "");
+
+    std::size_t managed = 0;
+    for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
+    {
+        managed += free_frames[i].load(std::memory_order_relaxed) * arch::vm::page_sizes[i];
+        managed += used_frames[i].load(std::memory_order_relaxed) * arch::vm::page_sizes[i];
+    }
+
+    // this doesn't grow with the amount of memory, as only the unaligned ends of free ranges are touched; the
+    // amount of memory is printed alongside, so that boot logs of differently sized machines can be compared
+    log::println(
+        " > Initialization took {} timestamp counter ticks, for {} MiB of memory.",
+        arch::cpu::get_timestamp_counter() - initialization_start,
+        managed / (1024 * 1024));
 }
 
 void report()
@@ -205,8 +1283,8 @@ void report()
 
     for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
     {
-        free += free_frames[i] * arch::vm::page_sizes[i];
-        used += used_frames[i] * arch::vm::page_sizes[i];
+        free += free_frames[i].load(std::memory_order_relaxed) * arch::vm::page_sizes[i];
+        used += used_frames[i].load(std::memory_order_relaxed) * arch::vm::page_sizes[i];
     }
 
     auto total = free + used;
@@ -227,17 +1305,94 @@ void report()
     log::println(" > Free frames:");
     for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
     {
-        log::println(" >> {}: {}", arch::vm::page_sizes[i], free_frames[i]);
+        log::println(" >> {}: {}", arch::vm::page_sizes[i], free_frames[i].load(std::memory_order_relaxed));
     }
     log::println(" > Used frames:");
     for (std::size_t i = 0; i < arch::vm::page_size_count; ++i)
     {
-        log::println(" >> {}: {}", arch::vm::page_sizes[i], used_frames[i]);
+        log::println(" >> {}: {}", arch::vm::page_sizes[i], used_frames[i].load(std::memory_order_relaxed));
+    }
+
+    std::size_t reclaimable = 0;
+    for (std::size_t i = 0; i < boot_range_count; ++i)
+    {
+        reclaimable += boot_ranges[i].second.value() - boot_ranges[i].first.value();
     }
 
     log::println(" > Total free memory: {} GiB {} MiB {} KiB", free_gib, free_mib, free_kib);
     log::println(" > Total used memory: {} GiB {} MiB {} KiB", used_gib, used_mib, used_kib);
     log::println(" > Total memory: {} GiB {} MiB {} KiB", total_gib, total_mib, total_kib);
+    if (reclaimable)
+    {
+        log::println(" > Used memory to be reclaimed after boot: {} KiB", reclaimable / 1024);
+    }
+
+    fragmentation_info info;
+    for (std::size_t i = 0; i < node_count; ++i)
+    {
+        node_managers[i].add_fragmentation(info);
+    }
+
+    // free frames of a layer are all ones that couldn't be coalesced into a frame of the layer above: either
+    // because some of their neighbours are in use, or because they aren't in a region at all
+    log::println(" > Fragmentation:");
+    for (std::size_t i = 0; i < arch::vm::page_size_count - 1; ++i)
+    {
+        auto free_count = free_frames[i].load(std::memory_order_relaxed);
+        auto region_count = info.region_frames[i] < free_count ? info.region_frames[i] : free_count;
+
+        log::println(
+            " >> {}: {}% of free memory can't be coalesced into frames of size {}; {} free frames in {} "
+            "partially used blocks, {} outside of regions",
+            arch::vm::page_sizes[i],
+            free ? free_count * arch::vm::page_sizes[i] * 100 / free : 0,
+            arch::vm::page_sizes[i + 1],
+            region_count,
+            info.partial_blocks[i],
+            free_count - region_count);
+    }
+}
+
+void reclaim_boot_memory()
+{
+    log::println("[PMM] Reclaiming memory used during boot...");
+
+    // ACPI reclaimable memory is where the firmware keeps the ACPI tables
+    acpi::release_tables();
+
+    std::size_t reclaimed = 0;
+    for (std::size_t i = 0; i < boot_range_count; ++i)
+    {
+        auto [start, end] = boot_ranges[i];
+        log::println(" > {:#018x} - {:#018x}.", start.value(), end.value());
+
+        reclaim_range(start, end);
+        reclaimed += end.value() - start.value();
+    }
+
+    boot_range_count = 0;
+
+    log::println(" > Reclaimed {} KiB of memory.", reclaimed / 1024);
+}
+
+void reclaim_boot_range(phys_addr_t start, std::size_t size)
+{
+    reclaim_range(start, start + size);
+}
+
+void enable_per_core_caches()
+{
+    log::println("[PMM] Enabling per-core frame caches.");
+
+    for (std::size_t i = 0; i < arch::cpu::get_core_count(); ++i)
+    {
+        auto core = arch::cpu::get_core_by_id(i);
+        auto node = node_for_domain(core->proximity_domain());
+        log::println(" > Core #{} allocates from NUMA node {}.", i, node);
+        core->get_frame_cache()->set_node(node);
+    }
+
+    per_core_caches_enabled.store(true, std::memory_order_release);
 }
 
 std::uintptr_t get_sub_1M_bottom()
@@ -251,29 +1406,218 @@ std::uintptr_t get_sub_1M_top()
 }
 
 phys_addr_t pop(std::size_t page_layer)
+{
+    phys_addr_t ret;
+    pop_n(page_layer, &ret, 1);
+    return ret;
+}
+
+void push(std::size_t page_layer, phys_addr_t frame)
+{
+    push_n(page_layer, &frame, 1);
+}
+
+std::optional<phys_addr_t> try_pop(std::size_t page_layer)
 {
     if (page_layer >= arch::vm::page_size_count)
     {
         PANIC("Tried to pop a frame beyond arch-supported frame sizes: {}!", page_layer);
     }
 
-    auto ret = global_manager.pop(page_layer);
+    auto node = current_node();
 
-    --free_frames[page_layer];
-    ++used_frames[page_layer];
+    for (std::size_t i = 0; i < node_count; ++i)
+    {
+        phys_addr_t ret;
+        if (node_managers[node_fallback_order[node][i]].pop_batch(page_layer, &ret, 1) == 1)
+        {
+            initialize_metadata(page_layer, &ret, 1);
+
+            free_frames[page_layer].fetch_sub(1, std::memory_order_relaxed);
+            used_frames[page_layer].fetch_add(1, std::memory_order_relaxed);
+
+            return ret;
+        }
+    }
+
+    return std::nullopt;
+}
 
+phys_addr_t pop_zeroed(std::size_t page_layer)
+{
+    phys_addr_t ret;
+    pop_zeroed_n(page_layer, &ret, 1);
     return ret;
 }
 
-void push(std::size_t page_layer, phys_addr_t frame)
+void pop_zeroed_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count)
+{
+    std::size_t popped = 0;
+
+    if (page_layer == 0)
+    {
+        popped = node_managers[current_node()].pop_zeroed_batch(frames, count);
+        initialize_metadata(0, frames, popped);
+
+        free_frames[0].fetch_sub(popped, std::memory_order_relaxed);
+        used_frames[0].fetch_add(popped, std::memory_order_relaxed);
+    }
+
+    if (popped == count)
+    {
+        return;
+    }
+
+    pop_n(page_layer, frames + popped, count - popped);
+
+    for (std::size_t i = popped; i < count; ++i)
+    {
+        std::memset(phys_ptr_t<char>{ frames[i] }.value(), 0, arch::vm::page_sizes[page_layer]);
+    }
+}
+
+bool zero_free_frames()
+{
+    if (!per_core_caches_enabled.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    std::size_t node;
+
+    {
+        util::interrupt_guard guard;
+        node = arch::cpu::get_current_core()->get_frame_cache()->get_node();
+    }
+
+    return node_managers[node].refill_zeroed();
+}
+
+void pop_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count)
+{
+    if (page_layer >= arch::vm::page_size_count)
+    {
+        PANIC("Tried to pop a frame beyond arch-supported frame sizes: {}!", page_layer);
+    }
+
+    if (per_core_caches_enabled.load(std::memory_order_acquire))
+    {
+        util::interrupt_guard guard;
+        arch::cpu::get_current_core()->get_frame_cache()->pop_n(page_layer, frames, count);
+    }
+
+    else
+    {
+        pop_from_nodes(0, page_layer, frames, count);
+    }
+
+    initialize_metadata(page_layer, frames, count);
+
+    free_frames[page_layer].fetch_sub(count, std::memory_order_relaxed);
+    used_frames[page_layer].fetch_add(count, std::memory_order_relaxed);
+}
+
+void push_n(std::size_t page_layer, const phys_addr_t * frames, std::size_t count)
 {
     if (page_layer >= arch::vm::page_size_count)
     {
         PANIC("Tried to push a frame beyond arch-supported frame sizes: {}!", page_layer);
     }
 
-    global_manager.push(page_layer, frame);
-    --used_frames[page_layer];
-    ++free_frames[page_layer];
+    finalize_metadata(frames, count);
+
+    if (per_core_caches_enabled.load(std::memory_order_acquire))
+    {
+        util::interrupt_guard guard;
+        arch::cpu::get_current_core()->get_frame_cache()->push_n(page_layer, frames, count);
+    }
+
+    else
+    {
+        push_to_nodes(page_layer, frames, count);
+    }
+
+    used_frames[page_layer].fetch_sub(count, std::memory_order_relaxed);
+    free_frames[page_layer].fetch_add(count, std::memory_order_relaxed);
+}
+
+std::optional<phys_addr_t> allocate_contiguous(
+    std::size_t size,
+    std::size_t alignment,
+    phys_addr_t max_address)
+{
+    if (alignment < arch::vm::page_sizes[0] || (alignment & (alignment - 1)))
+    {
+        PANIC("Invalid alignment of a contiguous allocation: {}!", alignment);
+    }
+
+    auto frame_count = (size + arch::vm::page_sizes[0] - 1) / arch::vm::page_sizes[0];
+    if (frame_count == 0)
+    {
+        return std::nullopt;
+    }
+
+    auto node = current_node();
+
+    for (std::size_t i = 0; i < node_count; ++i)
+    {
+        auto & manager = node_managers[node_fallback_order[node][i]];
+        auto base = manager.allocate_contiguous(frame_count, alignment, max_address);
+        if (!base)
+        {
+            continue;
+        }
+
+        for (std::size_t j = 0; j < frame_count; ++j)
+        {
+            auto metadata = get_frame_metadata(*base + j * arch::vm::page_sizes[0]);
+            metadata->refcount.store(1, std::memory_order_relaxed);
+            metadata->page_layer = 0;
+            metadata->flags = frame_flags::pinned;
+            metadata->owner = nullptr;
+        }
+
+        used_frames[0].fetch_add(frame_count, std::memory_order_relaxed);
+
+        return base;
+    }
+
+    return std::nullopt;
+}
+
+void free_contiguous(phys_addr_t base, std::size_t size)
+{
+    auto frame_count = (size + arch::vm::page_sizes[0] - 1) / arch::vm::page_sizes[0];
+
+    // the range goes back as individual smallest frames; they coalesce into larger ones as they are pushed
+    frame_batch freed(0);
+    for (std::size_t i = 0; i < frame_count; ++i)
+    {
+        freed.push(base + i * arch::vm::page_sizes[0]);
+    }
+}
+
+frame_metadata * get_frame_metadata(phys_addr_t frame)
+{
+    auto index = frame.value() / arch::vm::page_sizes[0];
+    if (index >= frame_metadata_count)
+    {
+        PANIC("Tried to get metadata of frame {:#018x}, which is beyond the managed memory!", frame.value());
+    }
+
+    return frame_metadata_array.value() + index;
+}
+
+void claim_frame(phys_addr_t frame)
+{
+    get_frame_metadata(frame)->refcount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void disown_frame(std::size_t page_layer, phys_addr_t frame)
+{
+    if (get_frame_metadata(frame)->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        push(page_layer, frame);
+    }
 }
 }
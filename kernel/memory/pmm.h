@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -21,21 +21,90 @@
 
 #include <boot-memmap.h>
 
+#include <atomic>
 #include <mutex>
+#include <optional>
+#include <utility>
 
 namespace kernel::pmm
 {
+enum class frame_flags : std::uint8_t
+{
+    none = 0,
+    pinned = 1 << 0,
+};
+
+inline frame_flags operator|(frame_flags lhs, frame_flags rhs)
+{
+    return static_cast<frame_flags>(std::to_underlying(lhs) | std::to_underlying(rhs));
+}
+
+inline bool operator&(frame_flags lhs, frame_flags rhs)
+{
+    return std::to_underlying(lhs) & std::to_underlying(rhs);
+}
+
+// Metadata of a single smallest frame, kept in an array indexed by the frame number. An entry is only
+// meaningful while the frame (or the larger frame it is the first part of) is handed out by the PMM; it is
+// (re)initialized when that happens, with the reference count set to 1. Entries are cleared before their
+// frames first reach the PMM, so the reference count of any frame that isn't handed out is 0.
+struct frame_metadata
+{
+    std::atomic<std::uint32_t> refcount;
+    std::uint8_t page_layer;
+    frame_flags flags;
+    std::uint16_t reserved;
+    void * owner;
+};
+
+static_assert(sizeof(frame_metadata) == 16);
+
+// How free frames of the layers below the largest are spread over the blocks of the layer above them.
+struct fragmentation_info
+{
+    // the free frames of a layer that belong to a region, and the blocks of the layer above that hold some,
+    // but not all of them, and so can't be handed out whole
+    std::size_t region_frames[arch::vm::page_size_count - 1] = {};
+    std::size_t partial_blocks[arch::vm::page_size_count - 1] = {};
+};
+
 class instance
 {
 public:
     instance() = default;
 
+    void add_region(phys_addr_t start, phys_addr_t end);
+    // Hands out the frames of a range without making it a region; they are not tracked in the bitmaps, so
+    // they never coalesce, and are never part of contiguous allocations. Unlike add_region, this is safe to
+    // call after other cores have started using the instance.
+    void add_frames(phys_addr_t start, phys_addr_t end);
+    bool owns(phys_addr_t frame);
+
     void push(std::size_t page_layer, phys_addr_t frame);
-    phys_addr_t pop(std::size_t page_layer);
+    std::optional<phys_addr_t> pop(std::size_t page_layer);
+
+    void push_batch(std::size_t page_layer, const phys_addr_t * frames, std::size_t count);
+    std::size_t pop_batch(std::size_t page_layer, phys_addr_t * frames, std::size_t count);
+
+    std::size_t pop_zeroed_batch(phys_addr_t * frames, std::size_t count);
+    bool refill_zeroed();
+
+    // Takes a run of `frame_count` physically contiguous smallest frames, starting at a multiple of
+    // `alignment` and ending no later than `limit`. This searches the bitmaps of all regions with all the
+    // locks held, so it is only meant for the rare allocations of buffers for devices.
+    std::optional<phys_addr_t> allocate_contiguous(
+        std::size_t frame_count,
+        std::size_t alignment,
+        phys_addr_t limit);
+
+    // Adds the fragmentation of the regions of this instance to `info`. Scans all the bitmaps, so it is only
+    // meant for reporting.
+    void add_fragmentation(fragmentation_info & info);
 
 private:
     struct _frame_header
     {
+        phys_ptr_t<_frame_header> prev;
         phys_ptr_t<_frame_header> next;
     };
 
@@ -46,15 +115,186 @@ private:
         std::size_t num_frames = 0;
     };
 
+    // A contiguous range of free memory, with a bitmap per page layer marking which blocks of that size
+    // are currently on the free stack of that layer. Block indices are relative to the start of the region
+    // aligned down to the largest page size, so that a block of one layer always maps to a contiguous
+    // group of blocks of the layer below it.
+    //
+    // The part of the region between lazy_start and lazy_end has not been handed to the free stacks yet;
+    // it is carved into frames of the largest size on demand, when the stack of that layer runs dry.
+    struct _region
+    {
+        phys_addr_t anchor;
+        phys_addr_t start;
+        phys_addr_t end;
+        phys_addr_t lazy_start;
+        phys_addr_t lazy_end;
+        phys_ptr_t<std::uint64_t> bitmaps[arch::vm::page_size_count];
+    };
+
+    static constexpr std::size_t _max_regions = 128;
+
+    static std::size_t _bitmap_words(phys_addr_t anchor, phys_addr_t end, std::size_t page_layer);
+    void _clear_lower_bitmaps(_region * region, phys_addr_t block);
+    bool _carve_locked(_stack_info & stack_info);
+    void _carve_block_locked(_stack_info & stack_info, _region & region);
+    void _push_range(phys_addr_t start, phys_addr_t end);
+
+    _region * _find_region(phys_addr_t frame);
+    void _set_free_bit(_region * region, std::size_t page_layer, phys_addr_t frame, bool value);
+    bool _get_free_bit(_region * region, std::size_t page_layer, phys_addr_t frame);
+    std::optional<phys_addr_t> _free_block_end(_region * region, phys_addr_t frame);
+
+    void _link_locked(_stack_info & stack_info, phys_addr_t frame);
+    void _unlink_locked(_stack_info & stack_info, phys_addr_t frame);
+
+    void _push_locked(std::size_t page_layer, _stack_info & stack_info, phys_addr_t frame);
+    std::optional<phys_addr_t> _pop_locked(std::size_t page_layer, _stack_info & stack_info);
+
+    void _link_range_locked(_region * region, phys_addr_t start, phys_addr_t end);
+    void _take_range_locked(_region * region, phys_addr_t start, phys_addr_t end);
+
     _stack_info _infos[arch::vm::page_size_count];
+
+    // smallest frames that have already been zeroed in the background, ready to be handed out by pop_zeroed;
+    // they are not on the free stacks, but still count as free
+    static constexpr std::size_t _zeroed_pool_size = 512;
+    _stack_info _zeroed;
+
+    _region _regions[_max_regions];
+    std::size_t _region_count = 0;
+};
+
+// A small per-core cache of free frames of the smaller page sizes, sitting in front of the global stacks.
+// It is refilled from and drained to the global stacks half a magazine at a time, so that the global locks
+// are only taken once per batch of frames. Refills come from the NUMA node of the owning core first; larger
+// frames bypass the cache, but are still allocated from that node. Must only be used by its owning core, with
+// interrupts disabled; other cores only ever try to take its lock, to take back its frames when memory runs
+// out, which keeps the lock uncontended otherwise.
+class frame_cache
+{
+public:
+    static constexpr std::size_t cached_layers = 2;
+
+    void set_node(std::size_t node)
+    {
+        _node = node;
+    }
+
+    std::size_t get_node() const
+    {
+        return _node;
+    }
+
+    void pop_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count);
+    void push_n(std::size_t page_layer, const phys_addr_t * frames, std::size_t count);
+    // Returns all cached frames to the global stacks, unless the cache is in use; meant to be called by other
+    // cores, which can't wait for the owner, as it may be waiting for them.
+    void try_drain();
+
+private:
+    static constexpr std::size_t _max_capacity = 64;
+    static constexpr std::size_t _capacities[cached_layers] = { 64, 4 };
+
+    struct _magazine
+    {
+        phys_addr_t frames[_max_capacity];
+        std::size_t count = 0;
+    };
+
+    std::size_t _node = 0;
+    std::mutex _lock;
+    _magazine _magazines[cached_layers];
 };
 
 void initialize(std::size_t memmap_size, boot_protocol::memory_map_entry * memmap);
 void report();
 
+// Hands memory that is only needed during boot back to the PMM: the bootloader's memory, the early kernel
+// stack, the memory map, and ACPI reclaimable memory (which makes the ACPI tables unavailable). Must only be
+// called once the kernel has handed off control to bootinit.
+void reclaim_boot_memory();
+// Hands back a single range of boot memory that outlives the above, like the initrd.
+void reclaim_boot_range(phys_addr_t start, std::size_t size);
+void enable_per_core_caches();
+
 std::uintptr_t get_sub_1M_bottom();
 std::uintptr_t get_sub_1M_top();
 
 phys_addr_t pop(std::size_t page_layer);
 void push(std::size_t page_layer, phys_addr_t);
+// Like pop, but returns nullopt instead of panicking when no frame is available; meant for opportunistic
+// allocations of large frames, which have a fallback. Bypasses the per-core caches.
+std::optional<phys_addr_t> try_pop(std::size_t page_layer);
+
+// Vectored variants of the above; these take the locks of the PMM once per batch instead of once per frame.
+void pop_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count);
+void push_n(std::size_t page_layer, const phys_addr_t * frames, std::size_t count);
+
+// Like pop/pop_n, but the returned frames are filled with zeroes. Smallest frames are taken from a pool that
+// is refilled by the idle loop of each core when possible.
+phys_addr_t pop_zeroed(std::size_t page_layer);
+void pop_zeroed_n(std::size_t page_layer, phys_addr_t * frames, std::size_t count);
+
+// Zeroes a single free frame into the pool of the current core's node. Returns whether any work was done;
+// meant to be called when a core has nothing better to do.
+bool zero_free_frames();
+
+// Allocates at least `size` bytes of physically contiguous memory, aligned to `alignment` (a power of two, no
+// smaller than the smallest page size) and lying entirely below `max_address`; meant for buffers that devices
+// access directly. The frames are marked as pinned. Returns nullopt if no such range is free.
+std::optional<phys_addr_t> allocate_contiguous(
+    std::size_t size,
+    std::size_t alignment,
+    phys_addr_t max_address);
+void free_contiguous(phys_addr_t base, std::size_t size);
+
+frame_metadata * get_frame_metadata(phys_addr_t frame);
+
+// Take and drop additional references to a frame that is shared between multiple owners. The frame is
+// returned to the PMM when the last reference is dropped.
+void claim_frame(phys_addr_t frame);
+void disown_frame(std::size_t page_layer, phys_addr_t frame);
+
+// Collects frames that are being freed, and returns them to the PMM in batches.
+class frame_batch
+{
+public:
+    frame_batch(std::size_t page_layer) : _page_layer(page_layer)
+    {
+    }
+
+    ~frame_batch()
+    {
+        flush();
+    }
+
+    frame_batch(const frame_batch &) = delete;
+    frame_batch & operator=(const frame_batch &) = delete;
+
+    void push(phys_addr_t frame)
+    {
+        _frames[_count++] = frame;
+        if (_count == _capacity)
+        {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (_count)
+        {
+            push_n(_page_layer, _frames, _count);
+            _count = 0;
+        }
+    }
+
+private:
+    static constexpr std::size_t _capacity = 64;
+
+    std::size_t _page_layer;
+    std::size_t _count = 0;
+    phys_addr_t _frames[_capacity];
+};
 }
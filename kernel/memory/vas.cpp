@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2025 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,16 +16,27 @@
 
 #include "vas.h"
 #include "../arch/cpu.h"
+#include "../scheduler/scheduler.h"
 #include "../scheduler/thread.h"
+#include "../util/interrupt_control.h"
+#include "../util/mp.h"
 
 namespace kernel::vm
 {
 namespace
 {
-    virt_addr_t generate_vdso_mapping_base()
+    // the lowest pages are never handed out by searches for free ranges, to keep null pointer accesses
+    // faulting; the last page below the non-canonical hole is skipped too
+    constexpr std::uintptr_t user_space_bottom = 0x10000;
+    constexpr std::uintptr_t user_space_top = 0x800000000000 - 4096;
+
+    // randomized placements stay out of the first 4 GiB, where mappings at fixed addresses (like images
+    // linked to low addresses) usually go, unless there's no room above
+    constexpr std::uintptr_t random_placement_bottom = 0x100000000;
+
+    std::uintptr_t align_up(std::uintptr_t value, std::size_t alignment)
     {
-        // TODO: randomize this
-        return virt_addr_t(0x800000000000 - get_vdso_vmo()->length() * 2);
+        return (value + alignment - 1) & ~(alignment - 1);
     }
 }
 
@@ -37,8 +48,7 @@ util::intrusive_ptr<vas> create_vas(bool randomly_map_vdso)
 
     if (randomly_map_vdso)
     {
-        auto vdso_base = generate_vdso_mapping_base();
-        ret->map_vmo(get_vdso_vmo(), vdso_base, flags::user);
+        ret->map_vmo_anywhere(get_vdso_vmo(), flags::user, true);
     }
 
     return ret;
@@ -55,7 +65,29 @@ util::intrusive_ptr<vas> adopt_existing_asid(phys_addr_t asid)
 
 vas::~vas()
 {
-    PANIC("this requires an amount of work tbh");
+    _vdso_mapping = {};
+
+    while (_mappings.begin() != _mappings.end())
+    {
+        auto mapping = &*_mappings.begin();
+
+        {
+            auto lock = mapping->lock();
+
+            // the page tables of the lower half are freed all at once below, but the upper half is shared
+            // with every other address space
+            if (mapping->range().start >= virt_addr_t(0x8000000000000000))
+            {
+                arch::vm::unmap(this, mapping->range().start, mapping->range().end, false);
+            }
+
+            mapping->release(lock);
+        }
+
+        _mappings.erase(mapping);
+    }
+
+    arch::vm::release_asid(_asid);
 }
 
 phys_addr_t vas::get_asid() const
@@ -112,34 +144,105 @@ util::intrusive_ptr<vmo_mapping> vas::map_vmo(
             it->range().end.value());
     }
 
+    return _map_vmo_locked(std::move(vm_object), mapping_base, fl);
+}
+
+util::intrusive_ptr<vmo_mapping> vas::map_vmo_anywhere(
+    util::intrusive_ptr<vmo> vm_object,
+    flags fl,
+    bool randomize)
+{
+    std::lock_guard _(_lock);
+
+    auto size = vm_object->length();
+    auto alignment = arch::vm::page_sizes[vm_object->page_alignment_level()];
+
+    // VMOs that span large pages are placed so that they can be mapped with them, when there's room for that
+    auto preferred_alignment = alignment;
+    if (size >= arch::vm::page_sizes[1] && alignment < arch::vm::page_sizes[1])
+    {
+        preferred_alignment = arch::vm::page_sizes[1];
+    }
+
+    auto find = [&](std::size_t align) -> std::optional<virt_addr_t>
+    {
+        if (randomize && size <= user_space_top - random_placement_bottom)
+        {
+            auto slots = (user_space_top - random_placement_bottom - size) / align;
+            auto hint = random_placement_bottom + arch::cpu::get_random() % (slots + 1) * align;
+
+            if (auto ret = _find_free_range(size, align, virt_addr_t(hint)))
+            {
+                return ret;
+            }
+        }
+
+        return _find_free_range(size, align, virt_addr_t(user_space_bottom));
+    };
+
+    auto address = find(preferred_alignment);
+    if (!address && preferred_alignment != alignment)
+    {
+        address = find(alignment);
+    }
+
+    if (!address)
+    {
+        return {};
+    }
+
+    return _map_vmo_locked(std::move(vm_object), *address, fl);
+}
+
+util::intrusive_ptr<vmo_mapping> vas::_map_vmo_locked(
+    util::intrusive_ptr<vmo> vm_object,
+    virt_addr_t mapping_base,
+    flags fl)
+{
+    auto mapping_end = mapping_base + vm_object->length();
     auto mapping = util::make_intrusive<vmo_mapping>(this, mapping_base, mapping_end, vm_object, fl);
-    _mappings.insert(mapping);
+
+    {
+        util::interrupt_guard guard;
+        _begin_mappings_change();
+        _mappings.insert(mapping);
+        _end_mappings_change();
+    }
 
     switch (vm_object->type())
     {
         case vmo_type::physical:
             arch::vm::map_physical(
-                this, mapping_base, mapping_base + vm_object->length(), vm_object->base(), fl);
+                this,
+                mapping_base,
+                mapping_base + vm_object->length(),
+                vm_object->base(),
+                with_caching_mode(fl, vm_object->caching_mode()));
             break;
 
         case vmo_type::sparse:
-            for (auto && element : vm_object->sparse_elements())
-            {
-                if (!element.backing_address)
+        case vmo_type::paged:
+        {
+            // the pages that haven't been committed or supplied yet are mapped when they are first accessed
+            auto vmo_lock = vm_object->lock();
+
+            vm_object->for_each_committed_page(
+                [&](std::size_t offset, phys_addr_t frame, std::size_t page_layer, bool copy_on_write)
                 {
-                    PANIC(
-                        "mapping uncommitted sparse VMOs is not supported yet (TODO after on-demand "
-                        "mapping)");
-                }
-
-                arch::vm::map_physical(
-                    this,
-                    mapping_base + element.offset,
-                    mapping_base + element.offset + page_size,
-                    *element.backing_address,
-                    fl);
-            }
+                    auto frame_size = arch::vm::page_sizes[page_layer];
+                    // a large frame can only be mapped with a single entry if the mapping is aligned to it
+                    auto mapping_layer = (mapping_base.value() & (frame_size - 1)) ? 0 : page_layer;
+
+                    arch::vm::map_physical(
+                        this,
+                        mapping_base + offset,
+                        mapping_base + offset + frame_size,
+                        frame,
+                        copy_on_write ? fl | flags::read_only : fl,
+                        mapping_layer);
+                });
             break;
+        }
 
         default:
             PANIC("unknown vmo type!");
@@ -155,33 +258,234 @@ util::intrusive_ptr<vmo_mapping> vas::map_vmo(
 
 void vas::unmap(vmo_mapping * mapping)
 {
-    auto lock = mapping->lock();
-    std::lock_guard _(_lock);
+    // the reference held by the tree is dropped below, but lookups may still be looking at the mapping, so
+    // it must stay alive until they are done
+    util::intrusive_ptr<vmo_mapping> keep_alive(mapping);
+
+    {
+        auto lock = mapping->lock();
+
+        // the mapping may have been released by the teardown of the VAS in the meantime, in which case the
+        // VAS must not be touched anymore; otherwise, the teardown waits for the lock of the mapping
+        if (mapping->is_invalid())
+        {
+            return;
+        }
 
-    arch::vm::unmap(this, mapping->range().start, mapping->range().end, false);
+        std::lock_guard _(_lock);
 
-    mapping->release(lock);
+        {
+            util::interrupt_guard guard;
+            _begin_mappings_change();
+            _mappings.erase(mapping);
+            _end_mappings_change();
+        }
+
+        // faults waiting for the lock of the mapping see that it's invalid once they get it, so the lock
+        // isn't held across the shootdown; the lock of the VAS keeps the range from being mapped again until
+        // then
+        mapping->invalidate(lock);
+        lock.unlock();
+
+        arch::vm::unmap(this, mapping->range().start, mapping->range().end, false);
+
+        lock.lock();
+        mapping->release(lock);
+    }
+
+    // lookups walk the tree of the VAS loaded on the current core, with interrupts disabled, so once every
+    // core the VAS is loaded on has handled an IPI, none of them can still be walking it through the removed
+    // mapping; cores that load it later only see the tree without it. Faults on the kernel half walk the tree
+    // of the kernel VAS on any core, whatever is loaded there, so for it, all cores must be waited for.
+    auto kernel_process = scheduler::get_kernel_process();
+    if (kernel_process && kernel_process->get_vas() == this)
+    {
+        mp::parallel_execute(mp::policy::all, +[] {});
+    }
+
+    else
+    {
+        mp::parallel_execute(
+            mp::policy::mask, +[] {}, reinterpret_cast<std::uintptr_t>(&get_tlb_state().loaded_on));
+    }
 }
 
-std::optional<std::shared_lock<std::shared_mutex>> vas::lock_address_range(
+bool vas::handle_page_fault(virt_addr_t address, bool write, bool can_wait)
+{
+    // the lock of the mapping keeps it from being unmapped while the page is faulted in
+    auto found = _find_and_lock_mapping(address_range{ address, address + 1 });
+    if (!found)
+    {
+        return false;
+    }
+
+    auto mapping = found->first;
+
+    if (write && mapping->has_flags(flags::read_only))
+    {
+        return false;
+    }
+
+    _page_faults.fetch_add(1, std::memory_order_relaxed);
+    switch (mapping->fault_in(address, write, can_wait))
+    {
+        case fault_result::mapped:
+            _pages_mapped.fetch_add(1, std::memory_order_relaxed);
+            return true;
+
+        case fault_result::already_mapped:
+        case fault_result::waiting:
+            return true;
+
+        case fault_result::unavailable:
+            return false;
+    }
+
+    return false;
+}
+
+std::optional<std::shared_lock<mp::ipi_handling_shared_mutex>> vas::lock_address_range(
     virt_addr_t start,
     virt_addr_t end,
     bool rw)
 {
-    std::lock_guard _(_lock);
+    auto found = _find_and_lock_mapping(address_range{ start, end });
+    if (!found)
+    {
+        return {};
+    }
+
+    auto mapping = found->first;
+
+    // the range must not extend past the mapping it overlaps, into unmapped memory or another mapping
+    if (start < mapping->range().start || mapping->range().end < end)
+    {
+        return {};
+    }
 
-    auto it = _mappings.find(address_range{ start, end });
-    if (it == _mappings.end())
+    if (rw && mapping->has_flags(flags::read_only))
     {
         return {};
     }
 
-    if (rw && it->has_flags(flags::read_only))
+    // the kernel can't wait for a pager while accessing user memory
+    if (mapping->get_vmo()->type() == vmo_type::paged)
     {
         return {};
     }
 
-    return { it->shared_lock() };
+    return { std::move(found->second) };
+}
+
+std::optional<virt_addr_t> vas::_find_free_range(std::size_t size, std::size_t alignment, virt_addr_t from)
+{
+    using tree = decltype(_mappings);
+
+    auto bottom = from.value() > user_space_bottom ? from.value() : user_space_bottom;
+
+    // `lower` and `upper` are the ends of the closest mappings outside of the subtree, so all of its gaps are
+    // between them; the gaps are only clipped to the lower half when one is picked, since mappings of the
+    // upper half are in the tree too
+    auto search = [&](auto & self, vmo_mapping * mapping, std::uintptr_t lower, std::uintptr_t upper)
+        -> std::optional<std::uintptr_t>
+    {
+        if (upper <= bottom || lower >= user_space_top || upper - lower < size)
+        {
+            return std::nullopt;
+        }
+
+        if (!mapping)
+        {
+            auto start = align_up(lower > bottom ? lower : bottom, alignment);
+            auto end = upper < user_space_top ? upper : user_space_top;
+            if (start < end && end - start >= size)
+            {
+                return start;
+            }
+            return std::nullopt;
+        }
+
+        auto & subtree = mapping->subtree;
+        auto largest = subtree.max_gap;
+        largest = subtree.start.value() - lower > largest ? subtree.start.value() - lower : largest;
+        largest = upper - subtree.end.value() > largest ? upper - subtree.end.value() : largest;
+        if (largest < size)
+        {
+            return std::nullopt;
+        }
+
+        if (auto ret = self(self, tree::left_child(mapping), lower, mapping->range().start.value()))
+        {
+            return ret;
+        }
+
+        return self(self, tree::right_child(mapping), mapping->range().end.value(), upper);
+    };
+
+    auto ret = search(search, _mappings.root(), 0, ~static_cast<std::uintptr_t>(0));
+    if (!ret)
+    {
+        return std::nullopt;
+    }
+
+    return virt_addr_t(*ret);
+}
+
+std::optional<std::pair<vmo_mapping *, std::shared_lock<mp::ipi_handling_shared_mutex>>> vas::
+    _find_and_lock_mapping(address_range range)
+{
+    while (true)
+    {
+        auto sequence = _mappings_sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+        {
+            asm volatile("pause" ::: "memory");
+            continue;
+        }
+
+        // nodes removed from the tree concurrently are still alive (see unmap), so the walk can't touch freed
+        // memory, but it can see a tree in the middle of a rebalance, in which case the result is discarded
+        auto it = _mappings.find(range);
+        auto mapping = it == _mappings.end() ? nullptr : &*it;
+
+        // the mapping is only guaranteed to be alive until this core handles an IPI, which waiting for its
+        // lock below can do, so a reference is taken while still in the read-side section
+        util::intrusive_ptr<vmo_mapping> keep_alive(mapping);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_mappings_sequence.load(std::memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+
+        if (!mapping)
+        {
+            return std::nullopt;
+        }
+
+        auto lock = mapping->shared_lock();
+
+        // unmapped between the walk and taking the lock
+        if (mapping->is_invalid())
+        {
+            continue;
+        }
+
+        // from here on, the lock keeps the mapping alive, as unmapping it waits for the lock while holding a
+        // reference of its own
+        return std::make_pair(mapping, std::move(lock));
+    }
+}
+
+void vas::_begin_mappings_change()
+{
+    _mappings_sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void vas::_end_mappings_change()
+{
+    _mappings_sequence.fetch_add(1, std::memory_order_release);
 }
 
 rose::syscall::result vas::syscall_rose_vas_create_handler(
@@ -222,17 +526,43 @@ rose::syscall::result vas::syscall_rose_mapping_create_handler(
     vmo * vmo,
     std::uintptr_t address,
     std::uintptr_t flags,
-    std::uintptr_t * token)
+    std::uintptr_t * token,
+    std::uintptr_t * mapped_address)
 {
-    if (flags != 0)
+    using rose::syscall::mapping_create_flags;
+
+    auto create_flags = static_cast<mapping_create_flags>(flags);
+    auto has_flag = [&](mapping_create_flags flag)
     {
-        PANIC("TODO: rose_mapping_create: non zero flags");
+        return (create_flags & flag) != mapping_create_flags::none;
+    };
+
+    // randomize only changes where anywhere looks for a free range
+    auto known_flags = mapping_create_flags::anywhere | mapping_create_flags::randomize;
+    if ((flags & ~std::to_underlying(known_flags)) != 0
+        || (has_flag(mapping_create_flags::randomize) && !has_flag(mapping_create_flags::anywhere)))
+    {
+        return rose::syscall::result::invalid_arguments;
     }
 
-    // TODO: remove when on demand mapping is supported
-    vmo->commit_all();
+    util::intrusive_ptr<vmo_mapping> mapping;
+
+    if (has_flag(mapping_create_flags::anywhere))
+    {
+        mapping = vas->map_vmo_anywhere(
+            util::intrusive_ptr(vmo), flags::user, has_flag(mapping_create_flags::randomize));
+        if (!mapping)
+        {
+            return rose::syscall::result::out_of_memory;
+        }
+    }
+
+    else
+    {
+        mapping = vas->map_vmo(util::intrusive_ptr(vmo), virt_addr_t(address), flags::user);
+    }
 
-    auto mapping = vas->map_vmo(util::intrusive_ptr(vmo), virt_addr_t(address), flags::user);
+    *mapped_address = mapping->range().start.value();
     auto handle = create_handle(std::move(mapping));
 
     *token = arch::cpu::get_core_local_storage()
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -18,14 +18,17 @@
 
 #include "vmo.h"
 
+#include "../arch/vm.h"
 #include "../util/avl_tree.h"
 #include "../util/chained_allocator.h"
 #include "vmo_mapping.h"
 
 #include <user/meta.h>
 
+#include <atomic>
 #include <memory>
 #include <shared_mutex>
+#include <utility>
 
 namespace kernel::vm
 {
@@ -53,6 +56,11 @@ public:
     phys_addr_t get_asid() const;
     bool claim_for_process();
 
+    arch::vm::tlb_state & get_tlb_state()
+    {
+        return _tlb_state;
+    }
+
     std::optional<virt_addr_t> get_vdso_base() const
     {
         if (!_vdso_mapping)
@@ -67,15 +75,42 @@ public:
         virt_addr_t address,
         flags flags = flags::none);
 
+    // Maps the VMO at the lowest free range of the lower half that fits it, or at a random one if `randomize`
+    // is true. Returns nullptr if there is no such range.
+    util::intrusive_ptr<vmo_mapping> map_vmo_anywhere(
+        util::intrusive_ptr<vmo> vmo,
+        flags flags = flags::none,
+        bool randomize = false);
+
     void unmap(vmo_mapping * mapping);
 
-    std::optional<std::shared_lock<std::shared_mutex>> lock_address_range(
+    // Resolves a fault on a page that isn't present, by committing and mapping the page of the VMO mapped
+    // there (or the zero frame, for reads), or a write fault on a page mapped read-only until it's written
+    // to, by giving it a frame of its own. Faults on pages of paged VMOs that the pager hasn't supplied yet
+    // park the current thread until it does, if `can_wait` is true. Returns false if there is no mapping
+    // that allows the access, or if the fault would need to wait but can't.
+    bool handle_page_fault(virt_addr_t address, bool write, bool can_wait);
+
+    struct fault_counters
+    {
+        std::size_t page_faults;
+        std::size_t pages_mapped;
+    };
+
+    fault_counters get_fault_counters() const
+    {
+        return { .page_faults = _page_faults.load(std::memory_order_relaxed),
+                 .pages_mapped = _pages_mapped.load(std::memory_order_relaxed) };
+    }
+
+    // Doesn't take the lock of the VAS; must be called with interrupts disabled (see _find_and_lock_mapping).
+    std::optional<std::shared_lock<mp::ipi_handling_shared_mutex>> lock_address_range(
         virt_addr_t start,
         virt_addr_t end,
         bool rw = false);
 
     template<typename T>
-    std::optional<std::shared_lock<std::shared_mutex>> lock_array_mapping(
+    std::optional<std::shared_lock<mp::ipi_handling_shared_mutex>> lock_array_mapping(
         T * ptr,
         std::size_t count,
         bool rw = false)
@@ -96,14 +131,49 @@ public:
         vmo * vmo_token,
         std::uintptr_t address,
         std::uintptr_t flags,
-        std::uintptr_t * token);
+        std::uintptr_t * token,
+        std::uintptr_t * mapped_address);
 
 private:
+    util::intrusive_ptr<vmo_mapping> _map_vmo_locked(
+        util::intrusive_ptr<vmo> vmo,
+        virt_addr_t address,
+        flags flags);
+
+    // Finds the lowest address at or above `from` where `size` bytes aligned to `alignment` fit between the
+    // mappings of the lower half, if there is one. Descends only into subtrees whose gaps are large enough.
+    std::optional<virt_addr_t> _find_free_range(std::size_t size, std::size_t alignment, virt_addr_t from);
+
+    // Finds the mapping overlapping the range and returns it locked for reading, which keeps it from being
+    // unmapped until the lock is dropped. The tree is walked without taking the lock of the VAS; the walk is
+    // retried if it raced with a change to the tree. Must be called with interrupts disabled, and only on the
+    // VAS loaded on the current core or on the kernel VAS, as mappings removed from the tree are only dropped
+    // once every core that can be walking it has handled an IPI.
+    std::optional<std::pair<vmo_mapping *, std::shared_lock<mp::ipi_handling_shared_mutex>>>
+    _find_and_lock_mapping(address_range range);
+
+    // Bracket every change of _mappings; must be called with _lock held and interrupts disabled, so that
+    // readers spinning on an odd sequence number can't wait for a preempted writer.
+    void _begin_mappings_change();
+    void _end_mappings_change();
+
     phys_addr_t _asid;
-    std::mutex _lock;
+    arch::vm::tlb_state _tlb_state;
+    mp::ipi_handling_mutex _lock;
     bool _was_claimed_for_process = false;
 
-    util::avl_tree<vmo_mapping, vmo_mapping_address_compare, util::intrusive_ptr_preserve_count_traits>
+    // all faults resolved in this VAS, and the ones among them that actually mapped a page; the difference
+    // are faults raced by other threads faulting in the same page
+    std::atomic<std::size_t> _page_faults = 0;
+    std::atomic<std::size_t> _pages_mapped = 0;
+
+    // only changed with _lock held, but walked without it; odd while a change is in progress
+    std::atomic<std::uint64_t> _mappings_sequence = 0;
+    util::avl_tree<
+        vmo_mapping,
+        vmo_mapping_address_compare,
+        util::intrusive_ptr_preserve_count_traits,
+        vmo_mapping_gap_augmentation>
         _mappings;
     util::intrusive_ptr<vmo_mapping> _vdso_mapping;
 };
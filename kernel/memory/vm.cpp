@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,8 +16,12 @@
 
 #include "vm.h"
 
+#include "../arch/cpu.h"
 #include "../arch/vm.h"
+#include "../util/address_arena.h"
+#include "../util/interrupt_control.h"
 #include "../util/intrusive_ptr.h"
+#include "pmm.h"
 #include "vmo.h"
 
 #include <boot-constants.h>
@@ -28,18 +32,142 @@ namespace kernel::vm
 {
 namespace
 {
-    std::atomic<std::uint64_t> vm_space_top = boot_protocol::kernel_base - 4096;
+    // the 512 GiB right below the kernel image, save for a guard page
+    constexpr std::uintptr_t kernel_space_size = static_cast<std::uintptr_t>(1) << 39;
+    constexpr std::uintptr_t kernel_space_base = boot_protocol::kernel_base - kernel_space_size;
+
+    std::mutex kernel_space_lock;
+    util::address_arena kernel_space(4096);
+    bool kernel_space_initialized = false;
+    std::atomic<bool> per_core_caches_enabled = false;
+
     util::intrusive_ptr<vmo> vdso_vmo{};
+    phys_addr_t zero_frame{};
+
+    void allocate_from_arena(std::size_t size, virt_addr_t * ranges, std::size_t count)
+    {
+        std::lock_guard _(kernel_space_lock);
+
+        if (!kernel_space_initialized)
+        {
+            kernel_space.add(kernel_space_base, kernel_space_size - 4096);
+            kernel_space_initialized = true;
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto base = kernel_space.allocate(size);
+            if (!base)
+            {
+                PANIC("kernel address space exhausted when allocating {} bytes!", size);
+            }
+
+            ranges[i] = virt_addr_t(*base);
+        }
+    }
+
+    void free_to_arena(std::size_t size, const virt_addr_t * ranges, std::size_t count)
+    {
+        std::lock_guard _(kernel_space_lock);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            kernel_space.free(ranges[i].value(), size);
+        }
+    }
+
+    std::size_t round_to_pages(std::size_t size)
+    {
+        return (size + 4095) & ~4095ull;
+    }
+}
+
+std::optional<virt_addr_t> address_cache::pop(std::size_t size)
+{
+    for (std::size_t i = 0; i < _cached_sizes; ++i)
+    {
+        if (_sizes[i] != size)
+        {
+            continue;
+        }
+
+        auto & magazine = _magazines[i];
+
+        if (magazine.count == 0)
+        {
+            auto refill_count = _capacities[i] / 2;
+            allocate_from_arena(size, magazine.ranges, refill_count);
+            magazine.count = refill_count;
+        }
+
+        return magazine.ranges[--magazine.count];
+    }
+
+    return std::nullopt;
+}
+
+bool address_cache::push(virt_addr_t base, std::size_t size)
+{
+    for (std::size_t i = 0; i < _cached_sizes; ++i)
+    {
+        if (_sizes[i] != size)
+        {
+            continue;
+        }
+
+        auto & magazine = _magazines[i];
+
+        if (magazine.count == _capacities[i])
+        {
+            auto drain_count = _capacities[i] / 2;
+            magazine.count -= drain_count;
+            free_to_arena(size, magazine.ranges + magazine.count, drain_count);
+        }
+
+        magazine.ranges[magazine.count++] = base;
+        return true;
+    }
+
+    return false;
 }
 
 virt_addr_t allocate_address_range(std::size_t size)
 {
-    auto real_size = size + 4095;
-    real_size &= ~4095ull;
+    size = round_to_pages(size);
+
+    if (per_core_caches_enabled.load(std::memory_order_acquire))
+    {
+        util::interrupt_guard guard;
+        if (auto cached = arch::cpu::get_current_core()->get_address_cache()->pop(size))
+        {
+            return *cached;
+        }
+    }
+
+    virt_addr_t ret;
+    allocate_from_arena(size, &ret, 1);
+    return ret;
+}
+
+void free_address_range(virt_addr_t base, std::size_t size)
+{
+    size = round_to_pages(size);
+
+    if (per_core_caches_enabled.load(std::memory_order_acquire))
+    {
+        util::interrupt_guard guard;
+        if (arch::cpu::get_current_core()->get_address_cache()->push(base, size))
+        {
+            return;
+        }
+    }
 
-    auto old = vm_space_top.fetch_sub(real_size);
+    free_to_arena(size, &base, 1);
+}
 
-    return virt_addr_t(old - real_size);
+void enable_per_core_caches()
+{
+    per_core_caches_enabled.store(true, std::memory_order_release);
 }
 
 void set_vdso_vmo(util::intrusive_ptr<vmo> vdso)
@@ -61,4 +189,24 @@ util::intrusive_ptr<vmo> get_vdso_vmo()
 
     return vdso_vmo;
 }
+
+void initialize_zero_frame()
+{
+    if (zero_frame.value())
+    {
+        PANIC("initialize_zero_frame called more than once!");
+    }
+
+    zero_frame = pmm::pop_zeroed(0);
+}
+
+phys_addr_t get_zero_frame()
+{
+    if (!zero_frame.value())
+    {
+        PANIC("get_zero_frame called before initialize_zero_frame");
+    }
+
+    return zero_frame;
+}
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -18,6 +18,9 @@
 
 #include "../util/pointer_types.h"
 
+#include <cstddef>
+#include <optional>
+
 namespace kernel::util
 {
 template<typename T>
@@ -28,15 +31,59 @@ namespace kernel::vm
 {
 class vmo;
 
+// Hands out ranges of the kernel address space, which is shared by all address spaces, in whole pages; the
+// ranges aren't mapped. Ranges are returned with free_address_range once nothing is mapped in them anymore,
+// with the same size they were allocated with.
 virt_addr_t allocate_address_range(std::size_t size);
+void free_address_range(virt_addr_t base, std::size_t size);
+void enable_per_core_caches();
+
+// A small per-core cache of free kernel address ranges of the sizes that are allocated most often (single
+// pages, and kernel stacks), sitting in front of the global arena. Like the frame caches of the PMM, it is
+// refilled from and drained to the arena half a magazine at a time, so that the lock of the arena is only
+// taken once per batch of ranges. Must only be accessed by its owning core, with interrupts disabled.
+class address_cache
+{
+public:
+    // Return nullopt and false respectively for sizes that aren't cached.
+    std::optional<virt_addr_t> pop(std::size_t size);
+    bool push(virt_addr_t base, std::size_t size);
+
+private:
+    static constexpr std::size_t _cached_sizes = 2;
+    static constexpr std::size_t _max_capacity = 16;
+    static constexpr std::size_t _sizes[_cached_sizes] = { 4096, 32 * 4096 };
+    static constexpr std::size_t _capacities[_cached_sizes] = { 16, 8 };
+
+    struct _magazine
+    {
+        virt_addr_t ranges[_max_capacity];
+        std::size_t count = 0;
+    };
+
+    _magazine _magazines[_cached_sizes];
+};
+
 void set_vdso_vmo(util::intrusive_ptr<vmo> vdso);
 util::intrusive_ptr<vmo> get_vdso_vmo();
 
+// A single frame of the smallest page size, filled with zeroes, that is mapped read-only in place of pages of
+// sparse VMOs that are read before they are ever written to. Never modified, and never freed.
+void initialize_zero_frame();
+phys_addr_t get_zero_frame();
+
 enum class flags : std::uintptr_t
 {
     none = 0,
     user = 1 << 0,
-    read_only = 1 << 1
+    read_only = 1 << 1,
+
+    // caching modes take up two bits, and are mutually exclusive; write-back is the default
+    write_back = 0 << 2,
+    write_combining = 1 << 2,
+    uncacheable = 2 << 2,
+    write_through = 3 << 2,
+    caching_modes = 3 << 2
 };
 
 inline bool operator&(flags lhs, flags rhs)
@@ -48,4 +95,18 @@ inline flags operator|(flags lhs, flags rhs)
 {
     return static_cast<flags>(static_cast<std::uintptr_t>(lhs) | static_cast<std::uintptr_t>(rhs));
 }
+
+inline flags caching_mode(flags fl)
+{
+    return static_cast<flags>(
+        static_cast<std::uintptr_t>(fl) & static_cast<std::uintptr_t>(flags::caching_modes));
+}
+
+// Replaces the caching mode in `fl` with `mode`.
+inline flags with_caching_mode(flags fl, flags mode)
+{
+    return static_cast<flags>(
+        (static_cast<std::uintptr_t>(fl) & ~static_cast<std::uintptr_t>(flags::caching_modes))
+        | static_cast<std::uintptr_t>(caching_mode(mode)));
+}
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -15,17 +15,26 @@
  */
 
 #include "vmo.h"
+#include "pmm.h"
+#include "vas.h"
+#include "vmo_mapping.h"
+#include "../arch/vm.h"
 #include "../arch/cpu.h"
+#include "../scheduler/mailbox.h"
+#include "../scheduler/scheduler.h"
 #include "../scheduler/thread.h"
+#include "../util/interrupt_control.h"
 
 #include <iterator>
+#include <new>
 
 namespace kernel::vm
 {
 util::intrusive_ptr<vmo> create_physical_vmo(
     phys_addr_t base,
     std::size_t length,
-    std::uint_least8_t aligned_to_page_level)
+    std::uint_least8_t aligned_to_page_level,
+    flags caching)
 {
     length +=
         (arch::vm::page_sizes[aligned_to_page_level] - length) % arch::vm::page_sizes[aligned_to_page_level];
@@ -36,7 +45,7 @@ util::intrusive_ptr<vmo> create_physical_vmo(
     ret->_length = length;
     ret->_aligned_to_page_level = aligned_to_page_level;
 
-    ret->_state.physical = { .base = base };
+    ret->_state.physical = { .base = base, .caching = caching_mode(caching) };
 
     return ret;
 }
@@ -52,11 +61,58 @@ util::intrusive_ptr<vmo> create_sparse_vmo(std::size_t length, std::uint_least8_
     ret->_length = length;
     ret->_aligned_to_page_level = aligned_to_page_level;
 
-    auto element = std::make_unique<vmo::_sparse_vmo_element>();
-    element->offset = 0;
+    auto pages = length / arch::vm::page_sizes[aligned_to_page_level];
+    new (&ret->_state.sparse) vmo::_sparse_vmo_state{ util::radix_tree(pages), util::radix_tree(pages) };
 
-    ret->_state.sparse = {};
-    ret->_state.sparse.elements.insert(std::move(element));
+    return ret;
+}
+
+util::intrusive_ptr<vmo> create_contiguous_vmo(std::size_t length, phys_addr_t max_address)
+{
+    length += (arch::vm::page_sizes[0] - length) % arch::vm::page_sizes[0];
+
+    auto base = pmm::allocate_contiguous(length, arch::vm::page_sizes[0], max_address);
+    if (!base)
+    {
+        return {};
+    }
+
+    // memory handed to userspace must not leak anything that was there before
+    std::memset(phys_ptr_t<char>{ *base }.value(), 0, length);
+
+    auto ret = create_physical_vmo(*base, length);
+    ret->_state.physical.owner = vmo::_physical_memory_owner::pmm;
+
+    return ret;
+}
+
+util::intrusive_ptr<vmo> create_boot_memory_vmo(phys_addr_t base, std::size_t length)
+{
+    auto ret = create_physical_vmo(base, length);
+    ret->_state.physical.owner = vmo::_physical_memory_owner::boot;
+
+    return ret;
+}
+
+util::intrusive_ptr<vmo> create_paged_vmo(
+    std::size_t length,
+    util::intrusive_ptr<ipc::mailbox> pager,
+    std::uintptr_t key)
+{
+    length += (arch::vm::page_sizes[0] - length) % arch::vm::page_sizes[0];
+
+    auto ret = util::make_intrusive<vmo>(vmo::_key_t{});
+
+    ret->_type = vmo_type::paged;
+    ret->_length = length;
+    ret->_aligned_to_page_level = 0;
+
+    auto pages = length / arch::vm::page_sizes[0];
+    new (&ret->_state.paged) vmo::_paged_vmo_state{ { util::radix_tree(pages), util::radix_tree(pages) },
+                                                     std::move(pager),
+                                                     key,
+                                                     util::radix_tree(pages),
+                                                     {} };
 
     return ret;
 }
@@ -66,24 +122,74 @@ vmo::~vmo()
     switch (_type)
     {
         case vmo_type::physical:
+            switch (_state.physical.owner)
+            {
+                case _physical_memory_owner::none:
+                    break;
+
+                case _physical_memory_owner::pmm:
+                    pmm::free_contiguous(_state.physical.base, _length);
+                    break;
+
+                case _physical_memory_owner::boot:
+                    pmm::reclaim_boot_range(_state.physical.base, _length);
+                    break;
+            }
+
             _state.physical.~_physical_vmo_state();
             break;
 
         case vmo_type::sparse:
-            for (auto && element : _state.sparse.elements)
+        {
+            pmm::frame_batch freed(_aligned_to_page_level);
+            pmm::frame_batch freed_large(1);
+
+            for_each_committed_page(
+                [&](std::size_t, phys_addr_t frame, std::size_t page_layer, bool copy_on_write)
+                {
+                    if (copy_on_write)
+                    {
+                        pmm::disown_frame(page_layer, frame);
+                    }
+
+                    else
+                    {
+                        (page_layer == _aligned_to_page_level ? freed : freed_large).push(frame);
+                    }
+                });
+
+            _state.sparse.~_sparse_vmo_state();
+            break;
+        }
+
+        case vmo_type::paged:
+        {
+            pmm::frame_batch freed(0);
+            for_each_committed_page(
+                [&](std::size_t, phys_addr_t frame, std::size_t, bool) { freed.push(frame); });
+
+            // the mappings the threads were waiting on are gone, so they'll fault again and find that out
             {
-                if (element.backing_address)
+                util::interrupt_guard guard;
+                while (!_state.paged.waiting_threads.empty())
                 {
-                    pmm::push(_aligned_to_page_level, *element.backing_address);
+                    scheduler::schedule(_state.paged.waiting_threads.pop_front());
                 }
             }
 
-            _state.sparse.~_sparse_vmo_state();
+            _state.paged.~_paged_vmo_state();
             break;
+        }
     }
 }
 
 void vmo::commit_between_offsets(std::size_t start_offset, std::size_t end_offset)
+{
+    std::lock_guard _(_lock);
+    _commit_between_offsets_locked(start_offset, end_offset);
+}
+
+void vmo::_commit_between_offsets_locked(std::size_t start_offset, std::size_t end_offset)
 {
     switch (_type)
     {
@@ -92,42 +198,58 @@ void vmo::commit_between_offsets(std::size_t start_offset, std::size_t end_offse
 
         case vmo_type::sparse:
         {
-            auto & elements = _state.sparse.elements;
+            auto & frames = _state.sparse.frames;
+
+            const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
 
-            auto begin = elements.lower_bound(start_offset);
-            if (begin->offset > start_offset)
+            auto first = start_offset / element_length;
+            end_offset = end_offset < _length ? end_offset : _length;
+            auto last = (end_offset + element_length - 1) / element_length;
+            if (first >= last)
             {
-                --begin;
+                return;
             }
 
-            auto end = elements.upper_bound(end_offset);
+            _unmap_zero_pages_locked(first, last);
 
-            while (begin != end)
+            // aligned runs of small pages that are committed as a whole are backed by large frames when
+            // possible, so that they can be mapped with a single entry
+            if (_aligned_to_page_level == 0)
             {
-                if (begin->backing_address)
+                const auto run_length = _pages_per_large_frame;
+
+                auto run = (first + run_length - 1) / run_length * run_length;
+                for (; run + run_length <= last; run += run_length)
                 {
-                    ++begin;
-                    continue;
+                    if (frames.count(run, run + run_length) == 0 && !_commit_large_frame_locked(run))
+                    {
+                        break;
+                    }
                 }
+            }
 
-                auto next = begin;
-                ++next;
-                const auto next_offset = next == elements.end() ? _length : next->offset;
+            // count the frames needed up front, so that they can be popped from the PMM in batches;
+            // sparse VMOs are always zero-filled, so that no data leaks between their users
+            std::size_t frames_needed = (last - first) - frames.count(first, last);
 
-                const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+            constexpr std::size_t batch_size = 64;
+            phys_addr_t batch[batch_size];
+            std::size_t frames_available = 0;
 
-                while (begin->offset + element_length < next_offset)
+            frames.fill(
+                first,
+                last,
+                [&](std::size_t)
                 {
-                    begin->backing_address = pmm::pop(_aligned_to_page_level);
-
-                    auto new_element = std::make_unique<_sparse_vmo_element>();
-                    new_element->offset = begin->offset + element_length;
-                    begin = elements.insert(next, std::move(new_element));
-                }
+                    if (frames_available == 0)
+                    {
+                        frames_available = frames_needed < batch_size ? frames_needed : batch_size;
+                        frames_needed -= frames_available;
+                        pmm::pop_zeroed_n(_aligned_to_page_level, batch, frames_available);
+                    }
 
-                begin->backing_address = pmm::pop(_aligned_to_page_level);
-                ++begin;
-            }
+                    return batch[--frames_available].value();
+                });
 
             return;
         }
@@ -137,22 +259,673 @@ void vmo::commit_between_offsets(std::size_t start_offset, std::size_t end_offse
     }
 }
 
+vmo::committed_page vmo::commit_page_locked(std::size_t offset, bool write)
+{
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+    offset -= offset % element_length;
+
+    switch (_type)
+    {
+        case vmo_type::physical:
+            return { _state.physical.base + offset, false };
+
+        case vmo_type::sparse:
+        {
+            auto & frames = _state.sparse.frames;
+            auto index = offset / element_length;
+
+            _commit_between_offsets_locked(offset, offset + element_length);
+
+            auto entry = *frames.find(index);
+            if (!(entry & _copy_on_write))
+            {
+                return { phys_addr_t{ entry & ~_large_frame }, false };
+            }
+
+            auto frame = phys_addr_t{ entry & ~_copy_on_write };
+            if (!write)
+            {
+                return { frame, true };
+            }
+
+            // whoever drops the last but one reference copies the frame, and the last owner keeps it
+            if (pmm::get_frame_metadata(frame)->refcount.load(std::memory_order_acquire) != 1)
+            {
+                auto copy = pmm::pop(0);
+                std::memcpy(
+                    phys_ptr_t<char>{ copy }.value(), phys_ptr_t<char>{ frame }.value(), element_length);
+                pmm::disown_frame(0, frame);
+                frame = copy;
+            }
+
+            frames.insert(index, frame.value());
+            _unmap_locked(index);
+
+            return { frame, false };
+        }
+
+        default:
+            PANIC("commit_page_locked() called on an VMO of unsupported type");
+    }
+}
+
+bool vmo::map_zero_page_locked(std::size_t offset)
+{
+    if (_type != vmo_type::sparse || _aligned_to_page_level != 0)
+    {
+        return false;
+    }
+
+    auto index = offset / arch::vm::page_sizes[0];
+    if (index >= _state.sparse.frames.capacity() || _state.sparse.frames.find(index))
+    {
+        return false;
+    }
+
+    _state.sparse.zero_mapped.insert(index, 0);
+    return true;
+}
+
+std::optional<phys_addr_t> vmo::commit_large_page_locked(std::size_t offset)
+{
+    if (_type != vmo_type::sparse || _aligned_to_page_level != 0)
+    {
+        return std::nullopt;
+    }
+
+    auto & frames = _state.sparse.frames;
+
+    auto index = offset / arch::vm::page_sizes[0];
+    index -= index % _pages_per_large_frame;
+    if (index + _pages_per_large_frame > frames.capacity())
+    {
+        return std::nullopt;
+    }
+
+    if (frames.count(index, index + _pages_per_large_frame) == 0 && !_commit_large_frame_locked(index))
+    {
+        return std::nullopt;
+    }
+
+    auto first = frames.find(index);
+    if (!first || !(*first & _large_frame))
+    {
+        return std::nullopt;
+    }
+
+    return phys_addr_t{ *first & ~_large_frame };
+}
+
+bool vmo::_commit_large_frame_locked(std::size_t index)
+{
+    auto large_frame = pmm::try_pop(1);
+    if (!large_frame)
+    {
+        return false;
+    }
+
+    std::memset(phys_ptr_t<char>{ *large_frame }.value(), 0, arch::vm::page_sizes[1]);
+
+    _unmap_zero_pages_locked(index, index + _pages_per_large_frame);
+
+    _state.sparse.frames.fill(
+        index,
+        index + _pages_per_large_frame,
+        [&](std::size_t i)
+        { return (*large_frame + (i - index) * arch::vm::page_sizes[0]).value() | _large_frame; });
+
+    return true;
+}
+
+bool vmo::can_promote_locked(std::size_t offset) const
+{
+    if (_type != vmo_type::sparse || _aligned_to_page_level != 0 || _mapping_count != 1)
+    {
+        return false;
+    }
+
+    auto & frames = _state.sparse.frames;
+
+    auto index = offset / arch::vm::page_sizes[0];
+    index -= index % _pages_per_large_frame;
+    if (index + _pages_per_large_frame > frames.capacity())
+    {
+        return false;
+    }
+
+    // frames shared with clones can't be replaced behind their backs
+    std::size_t private_pages = 0;
+    frames.for_each(
+        index,
+        index + _pages_per_large_frame,
+        [&](std::size_t, std::uintptr_t entry)
+        { private_pages += !(entry & (_large_frame | _copy_on_write)); });
+
+    return private_pages == _pages_per_large_frame;
+}
+
+void vmo::promote_locked(std::size_t offset, phys_addr_t large_frame)
+{
+    if (!can_promote_locked(offset))
+    {
+        PANIC("tried to promote a run of pages of a VMO that can't be promoted!");
+    }
+
+    auto & frames = _state.sparse.frames;
+
+    const auto page_size = arch::vm::page_sizes[0];
+    auto index = offset / page_size;
+    index -= index % _pages_per_large_frame;
+
+    pmm::frame_batch freed(0);
+
+    for (std::size_t i = 0; i < _pages_per_large_frame; ++i)
+    {
+        auto frame = phys_addr_t{ *frames.find(index + i) };
+        auto target = large_frame + i * page_size;
+
+        std::memcpy(phys_ptr_t<char>{ target }.value(), phys_ptr_t<char>{ frame }.value(), page_size);
+        frames.insert(index + i, target.value() | _large_frame);
+        freed.push(frame);
+    }
+}
+
+std::optional<phys_addr_t> vmo::find_supplied_page_locked(std::size_t offset) const
+{
+    if (_type != vmo_type::paged)
+    {
+        PANIC("find_supplied_page_locked() called on a VMO that isn't paged");
+    }
+
+    auto entry = _state.paged.frames.find(offset / arch::vm::page_sizes[0]);
+    if (!entry)
+    {
+        return std::nullopt;
+    }
+
+    return phys_addr_t{ *entry };
+}
+
+namespace
+{
+    struct page_wait_state
+    {
+        virt_addr_t address;
+        bool write;
+    };
+
+    // Runs when a thread parked in wait_for_page_locked() is resumed, to map the page it faulted on right
+    // away if it has been supplied, instead of returning to the faulting instruction just to fault again.
+    bool resume_page_fault(std::uintptr_t &, void * raw_state)
+    {
+        auto state = static_cast<page_wait_state *>(raw_state);
+
+        auto vas = arch::cpu::get_core_local_storage()->current_thread->get_container()->get_vas();
+        vas->handle_page_fault(state->address, state->write, false);
+
+        return true;
+    }
+}
+
+void vmo::wait_for_page_locked(std::size_t offset, virt_addr_t address, bool write)
+{
+    if (_type != vmo_type::paged)
+    {
+        PANIC("wait_for_page_locked() called on a VMO that isn't paged");
+    }
+
+    auto & state = _state.paged;
+
+    const auto page_size = arch::vm::page_sizes[0];
+    auto index = offset / page_size;
+
+    if (!state.requested.find(index))
+    {
+        state.requested.insert(index, 0);
+        state.pager->send(rose::syscall::mailbox_user_message{ state.key, index * page_size });
+    }
+
+    auto cls = arch::cpu::get_core_local_storage();
+    cls->current_thread->set_continuation(&resume_page_fault, page_wait_state{ address, write });
+
+    util::interrupt_guard guard;
+    state.waiting_threads.push_back(cls->current_core->get_scheduler()->deschedule());
+}
+
+void vmo::_supply_pages(std::size_t offset, const phys_addr_t * frames, std::size_t count)
+{
+    util::interrupt_guard guard;
+    std::lock_guard _(_lock);
+
+    auto & state = _state.paged;
+
+    auto first = offset / arch::vm::page_sizes[0];
+
+    // pages that are already there are kept, as they may have been mapped already
+    pmm::frame_batch duplicates(0);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (state.frames.find(first + i))
+        {
+            duplicates.push(frames[i]);
+            continue;
+        }
+
+        state.frames.insert(first + i, frames[i].value());
+    }
+
+    state.requested.erase(first, first + count);
+
+    // threads waiting for other pages just fault again when they resume
+    while (!state.waiting_threads.empty())
+    {
+        scheduler::schedule(state.waiting_threads.pop_front());
+    }
+}
+
 void vmo::commit_all()
 {
     commit_between_offsets(0, _length);
 }
 
+void vmo::read(std::size_t offset, void * buffer, std::size_t size) const
+{
+    std::lock_guard _(_lock);
+
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+    auto out = static_cast<char *>(buffer);
+
+    while (size)
+    {
+        auto in_page = offset % element_length;
+        auto chunk = element_length - in_page < size ? element_length - in_page : size;
+
+        std::optional<phys_addr_t> frame;
+        switch (_type)
+        {
+            case vmo_type::physical:
+                frame = _state.physical.base + (offset - in_page);
+                break;
+
+            case vmo_type::sparse:
+                if (auto entry = _state.sparse.frames.find(offset / element_length))
+                {
+                    frame = phys_addr_t{ *entry & ~(_large_frame | _copy_on_write) };
+                }
+                break;
+
+            default:
+                PANIC("read() called on an VMO of unsupported type");
+        }
+
+        if (frame)
+        {
+            std::memcpy(out, phys_ptr_t<char>{ *frame + in_page }.value(), chunk);
+        }
+        else
+        {
+            std::memset(out, 0, chunk);
+        }
+
+        offset += chunk;
+        out += chunk;
+        size -= chunk;
+    }
+}
+
+void vmo::write(std::size_t offset, const void * buffer, std::size_t size)
+{
+    std::lock_guard _(_lock);
+
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+    auto in = static_cast<const char *>(buffer);
+
+    while (size)
+    {
+        auto in_page = offset % element_length;
+        auto chunk = element_length - in_page < size ? element_length - in_page : size;
+
+        auto frame = commit_page_locked(offset, true).frame;
+        std::memcpy(phys_ptr_t<char>{ frame + in_page }.value(), in, chunk);
+
+        offset += chunk;
+        in += chunk;
+        size -= chunk;
+    }
+}
+
+void vmo::decommit_between_offsets(std::size_t start_offset, std::size_t end_offset)
+{
+    std::lock_guard _(_lock);
+
+    if (_type != vmo_type::sparse)
+    {
+        PANIC("decommit_between_offsets() called on an VMO of unsupported type");
+    }
+
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+
+    end_offset = end_offset < _length ? end_offset : _length;
+    auto first = (start_offset + element_length - 1) / element_length;
+    auto last = end_offset / element_length;
+    if (first >= last)
+    {
+        return;
+    }
+
+    // the parts of the large frames on either end that are outside of the range stay committed
+    if (_aligned_to_page_level == 0)
+    {
+        if (first % _pages_per_large_frame != 0 || first + _pages_per_large_frame > last)
+        {
+            _demote_locked(first - first % _pages_per_large_frame);
+        }
+
+        if (last % _pages_per_large_frame != 0)
+        {
+            _demote_locked(last - last % _pages_per_large_frame);
+        }
+    }
+
+    // a single unmap per mapping, so that the TLB shootdowns are batched for the whole range
+    _unmap_range_locked(first, last);
+
+    auto & frames = _state.sparse.frames;
+
+    pmm::frame_batch freed(_aligned_to_page_level);
+    pmm::frame_batch freed_large(1);
+
+    frames.for_each(
+        first,
+        last,
+        [&](std::size_t index, std::uintptr_t entry)
+        {
+            if (entry & _copy_on_write)
+            {
+                pmm::disown_frame(_aligned_to_page_level, phys_addr_t{ entry & ~_copy_on_write });
+            }
+
+            else if (!(entry & _large_frame))
+            {
+                freed.push(phys_addr_t{ entry });
+            }
+
+            else if (index % _pages_per_large_frame == 0)
+            {
+                freed_large.push(phys_addr_t{ entry & ~_large_frame });
+            }
+        });
+
+    frames.erase(first, last);
+    // the pages mapped to the zero frame have just been unmapped too
+    _state.sparse.zero_mapped.erase(first, last);
+}
+
+void vmo::_demote_locked(std::size_t index)
+{
+    auto & frames = _state.sparse.frames;
+
+    auto entry = frames.find(index);
+    if (!entry || !(*entry & _large_frame))
+    {
+        return;
+    }
+
+    auto large_frame = phys_addr_t{ *entry & ~_large_frame };
+
+    // the contents must not change while they are being copied; faults on the run wait for the lock of the
+    // VMO
+    _unmap_range_locked(index, index + _pages_per_large_frame);
+
+    constexpr std::size_t batch_size = 64;
+    phys_addr_t batch[batch_size];
+    std::size_t frames_available = 0;
+
+    frames.transform(
+        index,
+        index + _pages_per_large_frame,
+        [&](std::size_t i, std::uintptr_t)
+        {
+            if (frames_available == 0)
+            {
+                pmm::pop_n(0, batch, batch_size);
+                frames_available = batch_size;
+            }
+
+            auto frame = batch[--frames_available];
+            std::memcpy(
+                phys_ptr_t<char>{ frame }.value(),
+                phys_ptr_t<char>{ large_frame + (i - index) * arch::vm::page_sizes[0] }.value(),
+                arch::vm::page_sizes[0]);
+
+            return frame.value();
+        });
+
+    pmm::push(1, large_frame);
+}
+
+void vmo::_unmap_range_locked(std::size_t first, std::size_t last)
+{
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+
+    for (auto mapping = _mappings; mapping; mapping = mapping->_vmo_next)
+    {
+        auto start = mapping->range().start;
+        arch::vm::unmap(
+            mapping->get_vas(), start + first * element_length, start + last * element_length, false);
+    }
+}
+
+void vmo::add_mapping(vmo_mapping * mapping)
+{
+    std::lock_guard _(_lock);
+
+    mapping->_vmo_next = _mappings;
+    if (_mappings)
+    {
+        _mappings->_vmo_prev = mapping;
+    }
+    _mappings = mapping;
+
+    ++_mapping_count;
+}
+
+void vmo::remove_mapping(vmo_mapping * mapping)
+{
+    std::lock_guard _(_lock);
+
+    if (mapping->_vmo_prev)
+    {
+        mapping->_vmo_prev->_vmo_next = mapping->_vmo_next;
+    }
+    else
+    {
+        _mappings = mapping->_vmo_next;
+    }
+
+    if (mapping->_vmo_next)
+    {
+        mapping->_vmo_next->_vmo_prev = mapping->_vmo_prev;
+    }
+
+    mapping->_vmo_prev = nullptr;
+    mapping->_vmo_next = nullptr;
+
+    --_mapping_count;
+}
+
+void vmo::_write_protect_locked(std::size_t first, std::size_t last)
+{
+    const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+
+    for (auto mapping = _mappings; mapping; mapping = mapping->_vmo_next)
+    {
+        auto start = mapping->range().start;
+        arch::vm::write_protect(
+            mapping->get_vas(), start + first * element_length, start + last * element_length);
+    }
+}
+
+void vmo::_unmap_zero_pages_locked(std::size_t first, std::size_t last)
+{
+    auto & zero_mapped = _state.sparse.zero_mapped;
+
+    zero_mapped.for_each(first, last, [&](std::size_t index, std::uintptr_t) { _unmap_locked(index); });
+    zero_mapped.erase(first, last);
+}
+
+void vmo::_unmap_locked(std::size_t index)
+{
+    _unmap_range_locked(index, index + 1);
+}
+
+util::intrusive_ptr<vmo> create_vmo_clone(vmo & parent, std::size_t offset, std::size_t length)
+{
+    const auto page_size = arch::vm::page_sizes[0];
+    length += (page_size - length) % page_size;
+
+    if (parent._type != vmo_type::sparse || parent._aligned_to_page_level != 0 || offset % page_size != 0
+        || offset > parent._length || length > parent._length - offset)
+    {
+        return {};
+    }
+
+    auto ret = create_sparse_vmo(length);
+
+    // the clone isn't visible to anyone else yet, so its lock is only taken for the sake of the functions
+    // that expect it to be held
+    std::lock_guard parent_lock(parent._lock);
+    std::lock_guard clone_lock(ret->_lock);
+
+    auto & parent_frames = parent._state.sparse.frames;
+    auto & frames = ret->_state.sparse.frames;
+
+    auto first = offset / page_size;
+    auto last = first + length / page_size;
+
+    // small frames are shared, and marked on both sides, so that whichever side writes to them first makes
+    // a copy for itself
+    parent_frames.transform(
+        first,
+        last,
+        [&](std::size_t index, std::uintptr_t entry)
+        {
+            if (entry & vmo::_large_frame)
+            {
+                return entry;
+            }
+
+            pmm::claim_frame(phys_addr_t{ entry & ~vmo::_copy_on_write });
+            frames.insert(index - first, entry | vmo::_copy_on_write);
+
+            return entry | vmo::_copy_on_write;
+        });
+
+    // large frames are copied right away instead, since the large pages mapping them can't be
+    // write-protected; the shared small frames are write-protected in all the existing mappings of the
+    // parent, in runs that stop at the large pages
+    std::optional<std::size_t> run_start;
+    auto write_protect_run = [&](std::size_t run_end)
+    {
+        if (run_start)
+        {
+            parent._write_protect_locked(*run_start, run_end);
+            run_start = std::nullopt;
+        }
+    };
+
+    parent_frames.for_each(
+        first,
+        last,
+        [&](std::size_t index, std::uintptr_t entry)
+        {
+            if (!(entry & vmo::_large_frame))
+            {
+                if (!run_start)
+                {
+                    run_start = index;
+                }
+
+                return;
+            }
+
+            write_protect_run(index);
+
+            if (index == first || index % vmo::_pages_per_large_frame == 0)
+            {
+                auto large_frame_end =
+                    (index / vmo::_pages_per_large_frame + 1) * vmo::_pages_per_large_frame;
+                auto copy_end = large_frame_end < last ? large_frame_end : last;
+                ret->_commit_between_offsets_locked(
+                    (index - first) * page_size, (copy_end - first) * page_size);
+            }
+
+            auto target = phys_addr_t{ *frames.find(index - first) & ~vmo::_large_frame };
+            auto source = phys_addr_t{ entry & ~vmo::_large_frame };
+            std::memcpy(phys_ptr_t<char>{ target }.value(), phys_ptr_t<char>{ source }.value(), page_size);
+        });
+
+    write_protect_run(last);
+
+    return ret;
+}
+
 rose::syscall::result vmo::syscall_rose_vmo_create_handler(
     std::uintptr_t size,
     std::uintptr_t flags,
     std::uintptr_t * token)
 {
-    if (flags != 0)
+    using rose::syscall::vmo_create_flags;
+
+    auto create_flags = static_cast<vmo_create_flags>(flags);
+    auto has_flag = [&](vmo_create_flags flag)
+    {
+        return (create_flags & flag) != vmo_create_flags::none;
+    };
+
+    // below_4g only constrains where the memory of a contiguous VMO can be placed
+    auto known_flags = vmo_create_flags::contiguous | vmo_create_flags::below_4g;
+    if ((flags & ~std::to_underlying(known_flags)) != 0
+        || (has_flag(vmo_create_flags::below_4g) && !has_flag(vmo_create_flags::contiguous)))
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    util::intrusive_ptr<vm::vmo> vmo;
+
+    if (has_flag(vmo_create_flags::contiguous))
+    {
+        auto max_address = has_flag(vmo_create_flags::below_4g) ? phys_addr_t{ 4ull * 1024 * 1024 * 1024 }
+                                                                 : phys_addr_t{ ~0ull };
+
+        vmo = create_contiguous_vmo(size, max_address);
+        if (!vmo)
+        {
+            return rose::syscall::result::out_of_memory;
+        }
+    }
+
+    else
     {
-        PANIC("TODO: rose_vmo_create: non zero flags");
+        vmo = create_sparse_vmo(size);
     }
+    auto handle = create_handle(std::move(vmo));
 
-    auto vmo = create_sparse_vmo(size);
+    *token = arch::cpu::get_core_local_storage()
+                 ->current_thread->get_container()
+                 ->register_for_token(std::move(handle))
+                 .value();
+
+    return rose::syscall::result::ok;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_create_paged_handler(
+    std::uintptr_t size,
+    ipc::mailbox * pager,
+    std::uintptr_t key,
+    std::uintptr_t * token)
+{
+    auto vmo = create_paged_vmo(size, util::intrusive_ptr<ipc::mailbox>(pager), key);
     auto handle = create_handle(std::move(vmo));
 
     *token = arch::cpu::get_core_local_storage()
@@ -162,4 +935,199 @@ rose::syscall::result vmo::syscall_rose_vmo_create_handler(
 
     return rose::syscall::result::ok;
 }
+
+rose::syscall::result vmo::syscall_rose_vmo_clone_handler(
+    vmo * parent,
+    std::uintptr_t offset,
+    std::uintptr_t size,
+    std::uintptr_t * token)
+{
+    auto clone = create_vmo_clone(*parent, offset, size);
+    if (!clone)
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    auto handle = create_handle(std::move(clone));
+
+    *token = arch::cpu::get_core_local_storage()
+                 ->current_thread->get_container()
+                 ->register_for_token(std::move(handle))
+                 .value();
+
+    return rose::syscall::result::ok;
+}
+
+namespace
+{
+    bool is_valid_copy(const vmo * self, std::uintptr_t offset, std::uintptr_t buffer, std::uintptr_t size)
+    {
+        // device memory must not be accessed through the write-back physical memory window
+        // pages of paged VMOs only come from the pager
+        return self->type() != vmo_type::paged && self->caching_mode() == flags::write_back
+            && offset <= self->length() && size <= self->length() - offset && buffer + size >= buffer;
+    }
+
+    // The lock of the VMO can't be held while touching user memory, since faulting that in could need the
+    // lock of the same VMO; the data goes through a buffer on the stack instead.
+    constexpr std::size_t bounce_buffer_size = 512;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_read_handler(
+    vmo * self,
+    std::uintptr_t offset,
+    std::uintptr_t buffer,
+    std::uintptr_t size)
+{
+    if (!is_valid_copy(self, offset, buffer, size))
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    if (size == 0)
+    {
+        return rose::syscall::result::ok;
+    }
+
+    auto vas = arch::cpu::get_core_local_storage()->current_thread->get_container()->get_vas();
+    auto lock = vas->lock_address_range(virt_addr_t(buffer), virt_addr_t(buffer + size), true);
+    if (!lock)
+    {
+        return rose::syscall::result::invalid_pointers;
+    }
+
+    char bounce[bounce_buffer_size];
+    for (std::size_t copied = 0; copied < size;)
+    {
+        auto chunk = size - copied < bounce_buffer_size ? size - copied : bounce_buffer_size;
+
+        self->read(offset + copied, bounce, chunk);
+        std::memcpy(reinterpret_cast<char *>(buffer + copied), bounce, chunk);
+
+        copied += chunk;
+    }
+
+    return rose::syscall::result::ok;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_write_handler(
+    vmo * self,
+    std::uintptr_t offset,
+    std::uintptr_t buffer,
+    std::uintptr_t size)
+{
+    if (!is_valid_copy(self, offset, buffer, size))
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    if (size == 0)
+    {
+        return rose::syscall::result::ok;
+    }
+
+    auto vas = arch::cpu::get_core_local_storage()->current_thread->get_container()->get_vas();
+    auto lock = vas->lock_address_range(virt_addr_t(buffer), virt_addr_t(buffer + size), false);
+    if (!lock)
+    {
+        return rose::syscall::result::invalid_pointers;
+    }
+
+    char bounce[bounce_buffer_size];
+    for (std::size_t copied = 0; copied < size;)
+    {
+        auto chunk = size - copied < bounce_buffer_size ? size - copied : bounce_buffer_size;
+
+        std::memcpy(bounce, reinterpret_cast<const char *>(buffer + copied), chunk);
+        self->write(offset + copied, bounce, chunk);
+
+        copied += chunk;
+    }
+
+    return rose::syscall::result::ok;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_commit_handler(
+    vmo * self,
+    std::uintptr_t offset,
+    std::uintptr_t size)
+{
+    if (self->type() == vmo_type::paged || offset > self->length() || size > self->length() - offset)
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    self->commit_between_offsets(offset, offset + size);
+
+    return rose::syscall::result::ok;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_decommit_handler(
+    vmo * self,
+    std::uintptr_t offset,
+    std::uintptr_t size)
+{
+    if (self->type() != vmo_type::sparse || offset > self->length() || size > self->length() - offset)
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    self->decommit_between_offsets(offset, offset + size);
+
+    return rose::syscall::result::ok;
+}
+
+rose::syscall::result vmo::syscall_rose_vmo_supply_pages_handler(
+    vmo * self,
+    std::uintptr_t offset,
+    std::uintptr_t buffer,
+    std::uintptr_t size)
+{
+    const auto page_size = arch::vm::page_sizes[0];
+
+    if (self->type() != vmo_type::paged || offset % page_size != 0 || size % page_size != 0
+        || offset > self->length() || size > self->length() - offset || buffer + size < buffer)
+    {
+        return rose::syscall::result::invalid_arguments;
+    }
+
+    if (size == 0)
+    {
+        return rose::syscall::result::ok;
+    }
+
+    auto vas = arch::cpu::get_core_local_storage()->current_thread->get_container()->get_vas();
+    auto lock = vas->lock_address_range(virt_addr_t(buffer), virt_addr_t(buffer + size), false);
+    if (!lock)
+    {
+        return rose::syscall::result::invalid_pointers;
+    }
+
+    // the pages are filled in batches before the lock of the VMO is taken, as it can't be held while reading
+    // user memory
+    constexpr std::size_t batch_size = 64;
+    phys_addr_t batch[batch_size];
+
+    for (std::size_t supplied = 0; supplied < size;)
+    {
+        auto pages = (size - supplied) / page_size;
+        pages = pages < batch_size ? pages : batch_size;
+
+        pmm::pop_n(0, batch, pages);
+        for (std::size_t i = 0; i < pages; ++i)
+        {
+            std::memcpy(
+                phys_ptr_t<char>{ batch[i] }.value(),
+                reinterpret_cast<const char *>(buffer + supplied + i * page_size),
+                page_size);
+        }
+
+        self->_supply_pages(offset + supplied, batch, pages);
+
+        supplied += pages * page_size;
+    }
+
+    return rose::syscall::result::ok;
+}
+
 }
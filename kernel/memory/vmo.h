@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,25 +16,38 @@
 
 #pragma once
 
-#include "../util/avl_tree.h"
+#include "../util/fifo.h"
 #include "../util/handle.h"
 #include "../util/intrusive_ptr.h"
+#include "../util/mp.h"
+#include "../util/radix_tree.h"
 
 #include <user/meta.h>
 
+#include <mutex>
 #include <optional>
 
 namespace kernel::scheduler
 {
 class process;
+class thread;
+}
+
+namespace kernel::ipc
+{
+class mailbox;
 }
 
 namespace kernel::vm
 {
+class vmo_mapping;
+
 enum class vmo_type
 {
     physical,
-    sparse
+    sparse,
+    // like sparse, but missing pages are supplied by a pager process instead of being zero-filled
+    paged
 };
 
 class vmo : public util::intrusive_ptrable<vmo>
@@ -44,8 +57,15 @@ class vmo : public util::intrusive_ptrable<vmo>
     };
 
 public:
-    friend util::intrusive_ptr<vmo> create_physical_vmo(phys_addr_t, std::size_t, std::uint_least8_t);
+    friend util::intrusive_ptr<vmo> create_physical_vmo(phys_addr_t, std::size_t, std::uint_least8_t, flags);
     friend util::intrusive_ptr<vmo> create_sparse_vmo(std::size_t, std::uint_least8_t);
+    friend util::intrusive_ptr<vmo> create_contiguous_vmo(std::size_t, phys_addr_t);
+    friend util::intrusive_ptr<vmo> create_boot_memory_vmo(phys_addr_t, std::size_t);
+    friend util::intrusive_ptr<vmo> create_vmo_clone(vmo &, std::size_t, std::size_t);
+    friend util::intrusive_ptr<vmo> create_paged_vmo(
+        std::size_t,
+        util::intrusive_ptr<ipc::mailbox>,
+        std::uintptr_t);
 
     vmo(_key_t)
     {
@@ -78,61 +98,209 @@ public:
         return _state.physical.base;
     }
 
-    auto & sparse_elements() const
+    // The caching mode that the VMO is mapped with; always write-back for VMOs backed by regular memory.
+    flags caching_mode() const
     {
-        if (_type != vmo_type::sparse)
+        return _type == vmo_type::physical ? _state.physical.caching : flags::write_back;
+    }
+
+    // Calls `f(offset, frame, page_layer, copy_on_write)` for every committed page of a sparse or paged VMO,
+    // in increasing order of offsets. Runs of small pages that are backed by a single large frame are
+    // reported once, as a page of the larger layer. Pages whose frames are shared with clones of the VMO must
+    // only be mapped read-only. The lock of the VMO must be held.
+    template<typename F>
+    void for_each_committed_page(F && f) const
+    {
+        if (_type != vmo_type::sparse && _type != vmo_type::paged)
         {
-            PANIC("tied to get sparse elements of a non-sparse VMO!");
+            PANIC("tried to get committed pages of a non-sparse VMO!");
         }
 
-        return _state.sparse.elements;
+        const auto element_length = arch::vm::page_sizes[_aligned_to_page_level];
+        _committed_frames().for_each(
+            [&](std::size_t index, std::uintptr_t frame)
+            {
+                if (!(frame & _large_frame))
+                {
+                    f(index * element_length,
+                      phys_addr_t{ frame & ~_copy_on_write },
+                      _aligned_to_page_level,
+                      static_cast<bool>(frame & _copy_on_write));
+                }
+
+                else if (index % _pages_per_large_frame == 0)
+                {
+                    f(index * element_length, phys_addr_t{ frame & ~_large_frame }, 1, false);
+                }
+            });
+    }
+
+    // Held while inspecting the sparse elements from the outside.
+    std::unique_lock<mp::ipi_handling_mutex> lock() const
+    {
+        return std::unique_lock{ _lock };
     }
 
+    // Mappings of the VMO register themselves here, so that pages can be write-protected or unmapped in all
+    // of them when their frames become shared with a clone, or stop being shared. Both take the lock.
+    void add_mapping(vmo_mapping * mapping);
+    void remove_mapping(vmo_mapping * mapping);
+
     void commit_between_offsets(std::size_t start, std::size_t end);
     void commit_all();
+    // Copy between the VMO and kernel memory through the physical memory window, without mapping anything.
+    // Reading uncommitted pages yields zeroes without committing them; writing commits them, and gives pages
+    // shared with clones frames of their own first. Both take the lock, so the buffer must not be memory that
+    // could fault on a mapping of this VMO.
+    void read(std::size_t offset, void * buffer, std::size_t size) const;
+    void write(std::size_t offset, const void * buffer, std::size_t size);
+
+    // Unmaps the whole pages of a sparse VMO that lie between the offsets from all of its mappings, and hands
+    // their frames back (or drops the references to frames shared with clones). Large frames that only
+    // partially overlap the range are split into small frames first.
+    void decommit_between_offsets(std::size_t start, std::size_t end);
+
+    struct committed_page
+    {
+        phys_addr_t frame;
+        // the frame is shared with a clone of the VMO, and must only be mapped read-only
+        bool copy_on_write;
+    };
+
+    // Commits the page containing the offset, if it isn't yet, and returns the frame backing it. A page that
+    // is going to be written to first gets a frame of its own if its frame is shared with a clone; it is then
+    // unmapped from all mappings of the VMO, so that none of them keep seeing the old frame. The lock of the
+    // VMO must be held.
+    committed_page commit_page_locked(std::size_t offset, bool write);
+    // Records that the page containing the offset is going to be mapped to the shared zero frame, which is
+    // only done for uncommitted pages of sparse VMOs of small pages; returns false for any other page.
+    // Committing the page later unmaps it from all mappings of the VMO, so that none of them keep seeing the
+    // zero frame. Such pages don't count as committed. The lock of the VMO must be held.
+    bool map_zero_page_locked(std::size_t offset);
+    // Returns the large frame backing the aligned run of small pages containing the offset, committing the
+    // run with one if none of it is committed yet. Returns nullopt if the run isn't, and can't be, backed by
+    // a large frame. The lock of the VMO must be held.
+    std::optional<phys_addr_t> commit_large_page_locked(std::size_t offset);
+
+    // Moving a fully committed run of small pages to a large frame requires that nothing can write to them
+    // while their contents are copied, so it is split in two: the caller checks whether the run containing
+    // the offset can be promoted, allocates the large frame and unmaps the run, and then finishes the
+    // promotion, which frees the small frames. The lock of the VMO must be held throughout.
+    bool can_promote_locked(std::size_t offset) const;
+    void promote_locked(std::size_t offset, phys_addr_t large_frame);
+
+    // Returns the frame backing the page containing the offset of a paged VMO, if it has been supplied. The
+    // lock of the VMO must be held.
+    std::optional<phys_addr_t> find_supplied_page_locked(std::size_t offset) const;
+    // Asks the pager of a paged VMO for the page containing the offset, unless that has already been done,
+    // and parks the current thread until the pager supplies any pages. The thread is descheduled, and once
+    // resumed, maps the page if it's there by then, and returns to the faulting instruction. The lock of the
+    // VMO must be held.
+    void wait_for_page_locked(std::size_t offset, virt_addr_t address, bool write);
 
     static rose::syscall::result syscall_rose_vmo_create_handler(
         std::uintptr_t size,
         std::uintptr_t flags,
         std::uintptr_t * token);
+    static rose::syscall::result syscall_rose_vmo_clone_handler(
+        vmo * parent,
+        std::uintptr_t offset,
+        std::uintptr_t size,
+        std::uintptr_t * token);
+    static rose::syscall::result syscall_rose_vmo_read_handler(
+        vmo * self,
+        std::uintptr_t offset,
+        std::uintptr_t buffer,
+        std::uintptr_t size);
+    static rose::syscall::result syscall_rose_vmo_write_handler(
+        vmo * self,
+        std::uintptr_t offset,
+        std::uintptr_t buffer,
+        std::uintptr_t size);
+    static rose::syscall::result syscall_rose_vmo_create_paged_handler(
+        std::uintptr_t size,
+        ipc::mailbox * pager,
+        std::uintptr_t key,
+        std::uintptr_t * token);
+    static rose::syscall::result syscall_rose_vmo_supply_pages_handler(
+        vmo * self,
+        std::uintptr_t offset,
+        std::uintptr_t buffer,
+        std::uintptr_t size);
+    static rose::syscall::result syscall_rose_vmo_commit_handler(
+        vmo * self,
+        std::uintptr_t offset,
+        std::uintptr_t size);
+    static rose::syscall::result syscall_rose_vmo_decommit_handler(
+        vmo * self,
+        std::uintptr_t offset,
+        std::uintptr_t size);
 
 private:
+    const util::radix_tree & _committed_frames() const
+    {
+        return _type == vmo_type::paged ? _state.paged.frames : _state.sparse.frames;
+    }
+
+    void _commit_between_offsets_locked(std::size_t start, std::size_t end);
+    // Hands the frames over to a paged VMO as the pages starting at the offset, and wakes up the threads
+    // waiting for pages. Frames of pages that are already there are freed.
+    void _supply_pages(std::size_t offset, const phys_addr_t * frames, std::size_t count);
+    bool _commit_large_frame_locked(std::size_t index);
+    void _unmap_zero_pages_locked(std::size_t first, std::size_t last);
+    void _demote_locked(std::size_t index);
+    void _unmap_range_locked(std::size_t first, std::size_t last);
+    void _write_protect_locked(std::size_t first, std::size_t last);
+    void _unmap_locked(std::size_t index);
+
+    // marks the entries of sparse VMOs of small pages that are backed by a part of a large frame
+    static constexpr std::uintptr_t _large_frame = 0b10;
+    // marks the entries of sparse VMOs whose frames have been shared with a clone; the reference count of the
+    // frame tells whether it is still shared
+    static constexpr std::uintptr_t _copy_on_write = 0b100;
+    static constexpr std::size_t _pages_per_large_frame = arch::vm::page_sizes[1] / arch::vm::page_sizes[0];
+
+    mutable mp::ipi_handling_mutex _lock;
+    vmo_mapping * _mappings = nullptr;
+    std::size_t _mapping_count = 0;
     vmo_type _type;
     std::size_t _length;
     std::uint_least8_t _aligned_to_page_level;
 
-    struct _physical_vmo_state
+    enum class _physical_memory_owner
     {
-        phys_addr_t base;
+        // someone else manages the memory, e.g. it is device memory or a part of the kernel image
+        none,
+        // allocated from the PMM for this VMO
+        pmm,
+        // used during boot, and not known to the PMM until it is reclaimed
+        boot
     };
 
-    struct _sparse_vmo_element : util::treeable<_sparse_vmo_element>
+    struct _physical_vmo_state
     {
-        std::size_t offset;
-        std::optional<phys_addr_t> backing_address;
+        phys_addr_t base;
+        // memory owned by the VMO is handed back to the PMM when it is destroyed
+        _physical_memory_owner owner = _physical_memory_owner::none;
+        flags caching = flags::write_back;
     };
 
-    struct _sparse_vmo_element_comparator
+    struct _sparse_vmo_state
     {
-        bool operator()(const _sparse_vmo_element & lhs, const _sparse_vmo_element & rhs) const
-        {
-            return lhs.offset < rhs.offset;
-        }
-
-        bool operator()(const _sparse_vmo_element & lhs, std::size_t value) const
-        {
-            return lhs.offset < value;
-        }
-
-        bool operator()(std::size_t value, const _sparse_vmo_element & rhs) const
-        {
-            return value < rhs.offset;
-        }
+        // indexed by the offset divided by the page size of the VMO
+        util::radix_tree frames;
+        // the uncommitted pages that are mapped to the zero frame somewhere, with the same indices
+        util::radix_tree zero_mapped;
     };
 
-    struct _sparse_vmo_state
+    struct _paged_vmo_state : _sparse_vmo_state
     {
-        util::avl_tree<_sparse_vmo_element, _sparse_vmo_element_comparator> elements;
+        util::intrusive_ptr<ipc::mailbox> pager;
+        // sent back to the pager in requests, to tell its VMOs apart
+        std::uintptr_t key;
+        // the pages that have been requested and not supplied yet, so that they are only requested once
+        util::radix_tree requested;
+        util::fifo<scheduler::thread, util::intrusive_ptr_preserve_count_traits> waiting_threads;
     };
 
     union _vmo_state
@@ -147,14 +315,33 @@ private:
 
         _physical_vmo_state physical;
         _sparse_vmo_state sparse;
+        _paged_vmo_state paged;
     };
 
     _vmo_state _state;
 };
 
+// Device memory, like framebuffers or MMIO registers, needs a caching mode other than the default write-back.
 util::intrusive_ptr<vmo> create_physical_vmo(
     phys_addr_t base,
     std::size_t length,
-    std::uint_least8_t aligned_to_page_level = 0);
+    std::uint_least8_t aligned_to_page_level = 0,
+    flags caching = flags::write_back);
 util::intrusive_ptr<vmo> create_sparse_vmo(std::size_t length, std::uint_least8_t aligned_to_page_level = 0);
+// Allocates physically contiguous memory below `max_address` and wraps it in a physical VMO; returns a null
+// pointer if no such memory is available.
+util::intrusive_ptr<vmo> create_contiguous_vmo(std::size_t length, phys_addr_t max_address);
+// Wraps memory that was in use during boot in a physical VMO, which reclaims it once destroyed.
+util::intrusive_ptr<vmo> create_boot_memory_vmo(phys_addr_t base, std::size_t length);
+// Creates a sparse VMO that shares the frames of a range of a sparse VMO of small pages until either of them
+// writes to them; runs backed by large frames are copied up front. Returns a null pointer if the range is
+// invalid.
+util::intrusive_ptr<vmo> create_vmo_clone(vmo & parent, std::size_t offset, std::size_t length);
+// Creates a VMO of small pages whose pages are supplied by a pager. The first time a missing page is
+// accessed, the pager is sent a user message, with `key` in `data0` and the offset of the page in `data1`;
+// it then supplies the page, and possibly the pages that follow it, with rose_vmo_supply_pages.
+util::intrusive_ptr<vmo> create_paged_vmo(
+    std::size_t length,
+    util::intrusive_ptr<ipc::mailbox> pager,
+    std::uintptr_t key);
 }
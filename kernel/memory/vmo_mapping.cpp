@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -15,18 +15,156 @@
  */
 
 #include "vmo_mapping.h"
+#include "../arch/vm.h"
+#include "pmm.h"
 #include "vas.h"
+#include "vm.h"
 
 namespace kernel::vm
 {
+fault_result vmo_mapping::fault_in(virt_addr_t address, bool write, bool can_wait)
+{
+    auto page_layer = _object->page_alignment_level();
+    auto page_size = arch::vm::page_sizes[page_layer];
+    auto page = virt_addr_t(address.value() & ~(page_size - 1));
+
+    // holding the lock of the VMO keeps the frames from being shared with a clone while they are being mapped
+    auto vmo_lock = _object->lock();
+
+    // pages of paged VMOs are never shared or mapped to the zero frame, so they are only faulted in once
+    if (_object->type() == vmo_type::paged)
+    {
+        if (arch::vm::try_virt_to_phys(_address_space, page))
+        {
+            return fault_result::already_mapped;
+        }
+
+        auto offset = page.value() - _range.start.value();
+        auto frame = _object->find_supplied_page_locked(offset);
+        if (!frame)
+        {
+            if (!can_wait)
+            {
+                return fault_result::unavailable;
+            }
+
+            _object->wait_for_page_locked(offset, address, write);
+            return fault_result::waiting;
+        }
+
+        arch::vm::map_physical(_address_space, page, page + page_size, *frame, _mapping_flags, page_layer);
+        return fault_result::mapped;
+    }
+
+    if (arch::vm::try_virt_to_phys(_address_space, page))
+    {
+        // only pages mapped to the zero frame, or to frames shared with a clone, are mapped read-only in a
+        // writable mapping; getting a frame of its own unmaps the page, so if it's still mapped, another
+        // thread has already handled it
+        if (!write)
+        {
+            return fault_result::already_mapped;
+        }
+
+        auto committed = _object->commit_page_locked(page.value() - _range.start.value(), true);
+        if (arch::vm::try_virt_to_phys(_address_space, page))
+        {
+            return fault_result::already_mapped;
+        }
+
+        arch::vm::map_physical(
+            _address_space, page, page + page_size, committed.frame, _mapping_flags, page_layer);
+        return fault_result::mapped;
+    }
+
+    // pages that are only read don't need a frame of their own until they are first written to
+    if (!write && _object->map_zero_page_locked(page.value() - _range.start.value()))
+    {
+        arch::vm::map_physical(
+            _address_space,
+            page,
+            page + page_size,
+            get_zero_frame(),
+            _mapping_flags | flags::read_only,
+            page_layer);
+        return fault_result::mapped;
+    }
+
+    auto large_page_size = arch::vm::page_sizes[1];
+    auto large_page = virt_addr_t(address.value() & ~(large_page_size - 1));
+    auto use_large_pages = page_layer == 0 && _fits_large_page(large_page);
+
+    if (use_large_pages)
+    {
+        if (auto frame = _object->commit_large_page_locked(large_page.value() - _range.start.value()))
+        {
+            arch::vm::map_physical(
+                _address_space, large_page, large_page + large_page_size, *frame, _mapping_flags, 1);
+            return fault_result::mapped;
+        }
+    }
+
+    auto committed = _object->commit_page_locked(page.value() - _range.start.value(), write);
+    arch::vm::map_physical(
+        _address_space,
+        page,
+        page + page_size,
+        committed.frame,
+        committed.copy_on_write ? _mapping_flags | flags::read_only : _mapping_flags,
+        page_layer);
+
+    if (use_large_pages)
+    {
+        _try_promote_locked(large_page);
+    }
+
+    return fault_result::mapped;
+}
+
+bool vmo_mapping::_fits_large_page(virt_addr_t large_page) const
+{
+    auto large_page_size = arch::vm::page_sizes[1];
+
+    // the offsets within the VMO must line up with the virtual addresses for a large frame to be mappable
+    return _range.start.value() % large_page_size == 0 && large_page >= _range.start
+        && large_page + large_page_size <= _range.end;
+}
+
+void vmo_mapping::_try_promote_locked(virt_addr_t large_page)
+{
+    auto large_page_size = arch::vm::page_sizes[1];
+    auto offset = large_page.value() - _range.start.value();
+
+    if (!_object->can_promote_locked(offset))
+    {
+        return;
+    }
+
+    auto frame = pmm::try_pop(1);
+    if (!frame)
+    {
+        return;
+    }
+
+    // the small frames must not be written to while their contents are being copied; any thread that touches
+    // them in the meantime faults, and waits for the lock of the VMO, which is held by the caller
+    arch::vm::unmap(_address_space, large_page, large_page + large_page_size, false);
+    _object->promote_locked(offset, *frame);
+    arch::vm::map_physical(
+        _address_space, large_page, large_page + large_page_size, *frame, _mapping_flags, 1);
+}
+
 rose::syscall::result vmo_mapping::syscall_rose_mapping_destroy_handler(vmo_mapping * mapping)
 {
-    if (mapping->is_invalid())
+    // the VAS may be torn down concurrently, releasing the mapping; vas::unmap checks for that again once it
+    // holds the lock of the mapping
+    auto vas = mapping->get_vas();
+    if (mapping->is_invalid() || !vas)
     {
         return rose::syscall::result::invalid_handle;
     }
 
-    mapping->get_vas()->unmap(mapping); // TODO: handle errors here and not with inline panics
+    vas->unmap(mapping); // TODO: handle errors here and not with inline panics
 
     return rose::syscall::result::ok;
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -31,14 +31,47 @@ struct address_range
     virt_addr_t end;
 };
 
+// Kept by the mapping tree of a VAS for the subtree rooted in every mapping: the range spanned by the
+// mappings in the subtree, and the largest gap between two consecutive ones among them. Lets searches for
+// free ranges skip subtrees that can't contain one.
+struct mapping_subtree_info
+{
+    virt_addr_t start;
+    virt_addr_t end;
+    std::size_t max_gap = 0;
+};
+
+enum class fault_result
+{
+    mapped,
+    // there was nothing to do, e.g. because another thread has faulted the page in first
+    already_mapped,
+    // the current thread has been parked until the pager of the VMO supplies the page
+    waiting,
+    // the page can only be mapped after the pager supplies it, but the fault can't wait for that
+    unavailable
+};
+
 class vmo_mapping : public util::intrusive_ptrable<vmo_mapping>
 {
+    friend class vmo;
+
 public:
     vmo_mapping * tree_parent = nullptr;
+    mapping_subtree_info subtree;
 
     vmo_mapping(vas * as, virt_addr_t start, virt_addr_t end, util::intrusive_ptr<vmo> object, flags fl)
         : _range{ start, end }, _object(std::move(object)), _address_space(as), _mapping_flags(fl)
     {
+        _object->add_mapping(this);
+    }
+
+    ~vmo_mapping()
+    {
+        if (_valid)
+        {
+            _object->remove_mapping(this);
+        }
     }
 
     const address_range & range() const
@@ -56,12 +89,17 @@ public:
         return _address_space;
     }
 
-    std::unique_lock<std::shared_mutex> lock() const
+    vmo * get_vmo() const
+    {
+        return _object.get();
+    }
+
+    std::unique_lock<mp::ipi_handling_shared_mutex> lock() const
     {
         return std::unique_lock{ _lock };
     }
 
-    std::shared_lock<std::shared_mutex> shared_lock() const
+    std::shared_lock<mp::ipi_handling_shared_mutex> shared_lock() const
     {
         return std::shared_lock{ _lock };
     }
@@ -71,23 +109,46 @@ public:
         return !_valid;
     }
 
-    void release(const std::unique_lock<std::shared_mutex> &)
+    // Keeps faults and lookups from using the mapping anymore, while it stays registered with its VMO, so
+    // that the frames it still maps aren't freed from under it. Must be followed by release.
+    void invalidate(const std::unique_lock<mp::ipi_handling_shared_mutex> &)
     {
         _valid = false;
+    }
+
+    void release(const std::unique_lock<mp::ipi_handling_shared_mutex> &)
+    {
+        _valid = false;
+        _object->remove_mapping(this);
         _object.release(util::drop_count);
         _address_space = nullptr;
         _range = {};
     }
 
+    // Commits the page of the VMO that backs the address and maps it; a page written to while its frame is
+    // shared with a clone is given a copy of the frame instead, and an uncommitted page that is only read is
+    // mapped to the zero frame. Where the mapping is aligned to large pages, untouched runs of small pages
+    // are faulted in as a whole large page, and runs that become fully committed are promoted to one.
+    // Pages of paged VMOs that the pager hasn't supplied yet are requested from it, and if `can_wait` is
+    // true, the current thread is parked until they arrive.
+    fault_result fault_in(virt_addr_t address, bool write, bool can_wait);
+
     static rose::syscall::result syscall_rose_mapping_destroy_handler(vmo_mapping * mapping);
 
 private:
-    mutable std::shared_mutex _lock;
+    bool _fits_large_page(virt_addr_t large_page) const;
+    void _try_promote_locked(virt_addr_t large_page);
+
+    mutable mp::ipi_handling_shared_mutex _lock;
     address_range _range;
     util::intrusive_ptr<vmo> _object;
     vas * _address_space;
     flags _mapping_flags;
     bool _valid = true;
+
+    // the list of mappings of the VMO, protected by its lock
+    vmo_mapping * _vmo_prev = nullptr;
+    vmo_mapping * _vmo_next = nullptr;
 };
 
 struct vmo_mapping_address_compare
@@ -112,4 +173,32 @@ struct vmo_mapping_address_compare
         return lhs.end.value() <= rhs.start.value();
     }
 };
+
+struct vmo_mapping_gap_augmentation
+{
+    void operator()(vmo_mapping & mapping, vmo_mapping * left, vmo_mapping * right) const
+    {
+        auto & subtree = mapping.subtree;
+        subtree.start = left ? left->subtree.start : mapping.range().start;
+        subtree.end = right ? right->subtree.end : mapping.range().end;
+        subtree.max_gap = 0;
+
+        auto consider = [&](std::size_t gap)
+        {
+            subtree.max_gap = gap > subtree.max_gap ? gap : subtree.max_gap;
+        };
+
+        if (left)
+        {
+            consider(left->subtree.max_gap);
+            consider(mapping.range().start.value() - left->subtree.end.value());
+        }
+
+        if (right)
+        {
+            consider(right->subtree.max_gap);
+            consider(right->subtree.start.value() - mapping.range().end.value());
+        }
+    }
+};
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -43,6 +43,9 @@ void initialize()
         auto core = arch::cpu::get_core_by_id(i);
         core->get_scheduler()->initialize(&global_scheduler, core);
         core->get_core_local_storage()->current_thread = core->get_scheduler()->get_idle_thread();
+
+        // every core starts out in the address space of the kernel
+        kernel_process->get_vas()->get_tlb_state().loaded_on.set(i);
     }
 
     arch::irq::register_handler(
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -175,9 +175,11 @@ void instance::_reschedule(std::lock_guard<std::mutex> & lock)
     auto cls = arch::cpu::get_core_local_storage();
     auto old_thread = std::exchange(cls->current_thread, _current_thread);
 
-    if (old_thread->get_container()->get_vas() != _current_thread->get_container()->get_vas())
+    auto old_vas = old_thread->get_container()->get_vas();
+    auto new_vas = _current_thread->get_container()->get_vas();
+    if (old_vas != new_vas)
     {
-        arch::vm::set_asid(_current_thread->get_container()->get_vas()->get_asid());
+        arch::vm::switch_address_space(old_vas, new_vas);
     }
 
     _setup_preemption(lock);
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/address_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <utility>
+#include <vector>
+
+int main()
+{
+    const std::size_t quantum = 4096;
+    const std::uintptr_t base = 0x100000;
+    const std::size_t size = 1024 * quantum;
+
+    kernel::util::address_arena arena(quantum);
+    arena.add(base, size);
+    assert(arena.free_size() == size);
+
+    std::mt19937 engine(24);
+    std::vector<std::pair<std::uintptr_t, std::size_t>> allocated;
+
+    for (std::size_t round = 0; round < 4096; ++round)
+    {
+        if (!allocated.empty() && engine() % 2)
+        {
+            auto index = engine() % allocated.size();
+            arena.free(allocated[index].first, allocated[index].second);
+            allocated.erase(allocated.begin() + index);
+            continue;
+        }
+
+        // sizes that aren't powers of two, and sizes rounded up to the quantum, are allowed
+        auto allocation_size = (engine() % 32 + 1) * quantum - engine() % quantum;
+        auto address = arena.allocate(allocation_size);
+        if (!address)
+        {
+            continue;
+        }
+
+        allocation_size = (allocation_size + quantum - 1) / quantum * quantum;
+        assert(*address % quantum == 0);
+        assert(*address >= base && *address + allocation_size <= base + size);
+
+        for (auto [other, other_size] : allocated)
+        {
+            assert(*address + allocation_size <= other || other + other_size <= *address);
+        }
+
+        allocated.emplace_back(*address, allocation_size);
+    }
+
+    std::shuffle(allocated.begin(), allocated.end(), engine);
+    for (auto [address, allocation_size] : allocated)
+    {
+        arena.free(address, allocation_size);
+    }
+
+    // freed ranges have been merged back, so the whole arena can be handed out at once again
+    assert(arena.free_size() == size);
+    auto whole = arena.allocate(size);
+    assert(whole && *whole == base);
+    assert(!arena.allocate(quantum));
+
+    arena.free(*whole, size);
+
+    // a segment that only fits from the class of the size itself is still found
+    auto first = arena.allocate(size - 3 * quantum);
+    assert(first);
+    assert(arena.allocate(3 * quantum));
+    assert(!arena.allocate(quantum));
+}
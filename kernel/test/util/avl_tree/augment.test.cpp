@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/avl_tree.h"
+
+#include <cassert>
+#include <random>
+#include <set>
+
+struct foo : kernel::util::treeable<foo>
+{
+    int id;
+
+    // maintained by the augmentation below
+    std::size_t subtree_size = 0;
+    int subtree_max = 0;
+};
+
+struct comp
+{
+    bool operator()(const foo & lhs, const foo & rhs) const
+    {
+        return lhs.id < rhs.id;
+    }
+
+    bool operator()(const foo & lhs, int rhs) const
+    {
+        return lhs.id < rhs;
+    }
+
+    bool operator()(int lhs, const foo & rhs) const
+    {
+        return lhs < rhs.id;
+    }
+};
+
+struct augmentation
+{
+    void operator()(foo & element, foo * left, foo * right) const
+    {
+        element.subtree_size = 1 + (left ? left->subtree_size : 0) + (right ? right->subtree_size : 0);
+        element.subtree_max = right ? right->subtree_max : element.id;
+    }
+};
+
+using tree_type = kernel::util::avl_tree<foo, comp, kernel::util::unique_ptr_traits, augmentation>;
+
+// checks the augmented data of the whole subtree against its actual contents, and returns its size
+std::size_t check(foo * element)
+{
+    if (!element)
+    {
+        return 0;
+    }
+
+    auto left = tree_type::left_child(element);
+    auto right = tree_type::right_child(element);
+
+    auto size = 1 + check(left) + check(right);
+    assert(element->subtree_size == size);
+
+    auto max = element->id;
+    for (auto current = right; current; current = tree_type::right_child(current))
+    {
+        max = current->id;
+    }
+    assert(element->subtree_max == max);
+
+    return size;
+}
+
+int main()
+{
+    std::mt19937 engine(25);
+
+    for (std::size_t round = 0; round < 256; ++round)
+    {
+        tree_type tree;
+        std::set<int> present;
+
+        for (std::size_t step = 0; step < 256; ++step)
+        {
+            int id = engine() % 128;
+
+            if (present.count(id))
+            {
+                tree.erase(id);
+                present.erase(id);
+            }
+            else
+            {
+                auto f = std::make_unique<foo>();
+                f->id = id;
+                tree.insert(std::move(f));
+                present.insert(id);
+            }
+
+            assert(tree.check_invariants().correct);
+            assert(check(tree.root()) == present.size());
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/avl_tree.h"
+
+#include <cassert>
+
+std::size_t live = 0;
+
+struct foo : kernel::util::treeable<foo>
+{
+    foo(int id) : id(id)
+    {
+        ++live;
+    }
+
+    ~foo()
+    {
+        --live;
+    }
+
+    int id;
+};
+
+struct comp
+{
+    bool operator()(const foo & lhs, const foo & rhs) const
+    {
+        return lhs.id < rhs.id;
+    }
+};
+
+int main()
+{
+    // trees of every shape get created and destroyed over and over, like the mappings of address spaces;
+    // none of their elements may be left behind
+    for (int round = 0; round < 4096; ++round)
+    {
+        {
+            kernel::util::avl_tree<foo, comp> tree;
+
+            auto count = round % 37;
+            for (int i = 0; i < count; ++i)
+            {
+                tree.insert(std::make_unique<foo>((i * 7919 + round) % 1009));
+            }
+
+            assert(live <= static_cast<std::size_t>(count));
+        }
+
+        assert(live == 0);
+    }
+}
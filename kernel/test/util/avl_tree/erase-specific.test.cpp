@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -62,7 +62,9 @@ int main()
                       203278990, 203042084, 328512038, 328332526, 330111382, 329954762, 329308896, 331149766,
                       330942206, 330752144, 330553386, 331926252, 331638782, 331466720, 333359628, 333084672,
                       319178466, 322949618, 322599864, 322074266, 323544076, 327073816, 326796820 },
-          .erase = { 327073816, 326796820 } }
+          .erase = { 327073816, 326796820 } },
+        // the root, whose successor is its right child, and whose left child is heavy on the right
+        { .insert = { 11, 28, 34, 17 }, .erase = { 28 } }
     };
 
     for (auto && [insert, erase] : testcases)
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -58,4 +58,32 @@ int main()
 
     auto res = tree.lower_bound(foo{ .id = 33 });
     assert(res == tree.end());
+
+    // compare against a sorted sequence, for every value in and around the inserted range
+    std::sort(iter.begin(), iter.end());
+    for (int k = 0; k < 34; ++k)
+    {
+        auto it = tree.lower_bound(foo{ .id = k });
+        auto expected = std::lower_bound(iter.begin(), iter.end(), k);
+
+        if (expected == iter.end())
+        {
+            assert(it == tree.end());
+        }
+        else
+        {
+            assert(it != tree.end() && it->id == *expected);
+        }
+    }
+
+    // the result is an ancestor of the node at which the search ends, but not its parent
+    kernel::util::avl_tree<foo, comp> small_tree;
+    for (auto && i : { 2, 6, 8, 4 })
+    {
+        auto f = std::make_unique<foo>();
+        f->id = i;
+        small_tree.insert(std::move(f));
+    }
+
+    assert(small_tree.lower_bound(foo{ .id = 5 })->id == 6);
 }
@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the radix tree that sparse VMOs use to keep track of their frames with the representation they used
+// before: an AVL tree with a node per committed page. Prints the timings of committing, iterating over and
+// looking up every page of a 1 GiB VMO, and checks that both agree on the results. Not run as a test; it is
+// built by the build-benchmarks target.
+
+#include "../../../util/avl_tree.h"
+#include "../../../util/radix_tree.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+struct element : kernel::util::treeable<element>
+{
+    std::size_t offset;
+    std::optional<std::uintptr_t> backing_address;
+};
+
+struct comp
+{
+    bool operator()(const element & lhs, const element & rhs) const
+    {
+        return lhs.offset < rhs.offset;
+    }
+
+    bool operator()(const element & lhs, std::size_t value) const
+    {
+        return lhs.offset < value;
+    }
+
+    bool operator()(std::size_t value, const element & rhs) const
+    {
+        return value < rhs.offset;
+    }
+};
+
+template<typename F>
+auto measure(const char * name, F && f)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto ret = f();
+    auto end = std::chrono::steady_clock::now();
+
+    std::printf("%-24s %10.3f ms\n", name, std::chrono::duration<double, std::milli>(end - start).count());
+
+    return ret;
+}
+
+int main()
+{
+    constexpr std::size_t page_size = 4096;
+    constexpr std::size_t pages = 1024 * 1024 * 1024 / page_size;
+
+    kernel::util::avl_tree<element, comp> avl;
+    kernel::util::radix_tree radix(pages);
+
+    measure(
+        "avl_tree: commit",
+        [&]
+        {
+            for (std::size_t i = 0; i < pages; ++i)
+            {
+                auto e = std::make_unique<element>();
+                e->offset = i * page_size;
+                e->backing_address = i * page_size;
+                avl.insert(std::move(e));
+            }
+            return 0;
+        });
+
+    measure(
+        "radix_tree: commit",
+        [&]
+        {
+            radix.fill(0, pages, [](std::size_t index) { return index * page_size; });
+            return 0;
+        });
+
+    auto avl_sum = measure(
+        "avl_tree: iterate",
+        [&]
+        {
+            std::uintptr_t sum = 0;
+            for (auto && e : avl)
+            {
+                sum += *e.backing_address;
+            }
+            return sum;
+        });
+
+    auto radix_sum = measure(
+        "radix_tree: iterate",
+        [&]
+        {
+            std::uintptr_t sum = 0;
+            radix.for_each([&](std::size_t, std::uintptr_t frame) { sum += frame; });
+            return sum;
+        });
+
+    assert(avl_sum == radix_sum);
+
+    avl_sum = measure(
+        "avl_tree: lookup",
+        [&]
+        {
+            std::uintptr_t sum = 0;
+            for (std::size_t i = 0; i < pages; ++i)
+            {
+                sum += *avl.find(i * page_size)->backing_address;
+            }
+            return sum;
+        });
+
+    radix_sum = measure(
+        "radix_tree: lookup",
+        [&]
+        {
+            std::uintptr_t sum = 0;
+            for (std::size_t i = 0; i < pages; ++i)
+            {
+                sum += *radix.find(i);
+            }
+            return sum;
+        });
+
+    assert(avl_sum == radix_sum);
+}
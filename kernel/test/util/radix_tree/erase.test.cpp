@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/radix_tree.h"
+
+#include <cassert>
+#include <vector>
+
+int main()
+{
+    const std::size_t capacity = 512 * 3;
+
+    kernel::util::radix_tree tree(capacity);
+
+    std::vector<std::size_t> present = { 0, 1, 7, 511, 512, 1000, 1535 };
+    for (auto index : present)
+    {
+        tree.insert(index, index << 4);
+    }
+
+    tree.erase(1, 1001);
+
+    std::vector<std::size_t> remaining;
+    tree.for_each([&](std::size_t index, std::uintptr_t) { remaining.push_back(index); });
+    assert((remaining == std::vector<std::size_t>{ 0, 1535 }));
+
+    // erased indices can be filled again
+    tree.fill(0, 8, [](std::size_t index) { return index << 4; });
+    assert(tree.count(0, capacity) == 9);
+    assert(tree.find(7) == 7u << 4);
+
+    // erasing beyond the capacity, or ranges that were never populated, is harmless
+    tree.erase(1500, capacity * 2);
+    assert(!tree.find(1535));
+    assert(tree.count(0, capacity) == 8);
+}
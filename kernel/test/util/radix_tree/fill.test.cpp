@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/radix_tree.h"
+
+#include <cassert>
+#include <map>
+#include <vector>
+
+int main()
+{
+    // three levels, so that ranges cross boundaries of both leaves and interior nodes
+    const std::size_t capacity = 512 * 512 + 1000;
+
+    kernel::util::radix_tree tree(capacity);
+    std::map<std::size_t, std::uintptr_t> expected;
+
+    auto check = [&]
+    {
+        std::vector<std::pair<std::size_t, std::uintptr_t>> seen;
+        tree.for_each([&](std::size_t index, std::uintptr_t value) { seen.emplace_back(index, value); });
+        assert((seen == std::vector<std::pair<std::size_t, std::uintptr_t>>(expected.begin(), expected.end())));
+
+        for (std::size_t i = 0; i < capacity; i += 97)
+        {
+            auto it = expected.find(i);
+            auto found = tree.find(i);
+            assert(found.has_value() == (it != expected.end()));
+            assert(!found || *found == it->second);
+        }
+    };
+
+    check();
+    assert(tree.count(0, capacity) == 0);
+    assert(!tree.find(capacity));
+
+    tree.insert(700, 0x1000);
+    expected[700] = 0x1000;
+    check();
+
+    std::vector<std::pair<std::size_t, std::size_t>> ranges = {
+        { 0, 10 }, { 500, 1030 }, { 5, 20 }, { 512 * 512 - 3, 512 * 512 + 3 }, { 200000, 200001 }, { 690, 710 }
+    };
+
+    for (auto && [begin, end] : ranges)
+    {
+        std::size_t missing = 0;
+        for (auto i = begin; i < end; ++i)
+        {
+            missing += !expected.contains(i);
+        }
+        assert(tree.count(begin, end) == (end - begin) - missing);
+
+        tree.fill(
+            begin,
+            end,
+            [&](std::size_t index)
+            {
+                assert(!expected.contains(index));
+                expected[index] = index << 12;
+                return index << 12;
+            });
+
+        assert(tree.count(begin, end) == end - begin);
+        check();
+    }
+
+    // the value stored before the fill over its index must not be overwritten
+    assert(*tree.find(700) == 0x1000);
+
+    // fills are clamped to the capacity
+    tree.fill(capacity - 2, capacity + 10, [](std::size_t index) { return index << 12; });
+    expected[capacity - 2] = (capacity - 2) << 12;
+    expected[capacity - 1] = (capacity - 1) << 12;
+    check();
+
+    std::vector<std::size_t> in_range;
+    tree.for_each(505, 515, [&](std::size_t index, std::uintptr_t) { in_range.push_back(index); });
+    assert((in_range == std::vector<std::size_t>{ 505, 506, 507, 508, 509, 510, 511, 512, 513, 514 }));
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../../util/radix_tree.h"
+
+#include <cassert>
+#include <vector>
+
+int main()
+{
+    const std::size_t capacity = 512 * 3;
+
+    kernel::util::radix_tree tree(capacity);
+
+    std::vector<std::size_t> present = { 0, 1, 7, 511, 512, 1000, 1535 };
+    for (auto index : present)
+    {
+        tree.insert(index, index << 4);
+    }
+
+    std::vector<std::size_t> visited;
+    tree.transform(
+        1,
+        1001,
+        [&](std::size_t index, std::uintptr_t value)
+        {
+            assert(value == index << 4);
+            visited.push_back(index);
+            return value | 0b10;
+        });
+
+    // only the indices that have a value are visited, and no new ones are created
+    assert((visited == std::vector<std::size_t>{ 1, 7, 511, 512, 1000 }));
+    assert(tree.count(0, capacity) == present.size());
+
+    for (auto index : present)
+    {
+        auto expected = index << 4;
+        if (index >= 1 && index < 1001)
+        {
+            expected |= 0b10;
+        }
+
+        assert(tree.find(index) == expected);
+    }
+
+    assert(!tree.find(2));
+}
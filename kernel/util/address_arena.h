@@ -0,0 +1,306 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "avl_tree.h"
+#include "log.h"
+
+#include <atomic>
+#include <new>
+#include <optional>
+
+namespace kernel::util
+{
+// A vmem-style allocator of address ranges, in multiples of a quantum. Every range the arena knows about,
+// free or allocated, is a segment; segments are linked in address order, so that a freed segment is merged
+// with its free neighbours without searching for them (the boundary tags of vmem). Free segments are also
+// kept on lists by power of two size class, so that an allocation can take the first segment of the smallest
+// class that is guaranteed to fit (vmem's instant fit). All segments are kept in a tree by their base, which
+// is how a freed range is found. Not synchronized; the users are expected to lock around it.
+class address_arena
+{
+public:
+    address_arena(std::size_t quantum) : _quantum(quantum)
+    {
+    }
+
+    address_arena(const address_arena &) = delete;
+    address_arena & operator=(const address_arena &) = delete;
+
+    std::size_t quantum() const
+    {
+        return _quantum;
+    }
+
+    std::size_t free_size() const
+    {
+        return _free_size;
+    }
+
+    // Adds [base, base + size) to the ranges the arena hands out; it must not overlap anything added before.
+    void add(std::uintptr_t base, std::size_t size)
+    {
+        size = _round_up(size);
+
+        auto lower_it = _segments.floor(base);
+        auto lower = lower_it == _segments.end() ? nullptr : &*lower_it;
+        auto first = _segments.begin() == _segments.end() ? nullptr : &*_segments.begin();
+        auto higher = lower ? lower->higher : first;
+
+        if ((lower && lower->base + lower->size > base) || (higher && base + size > higher->base))
+        {
+            PANIC("tried to add a range ({:#018x}, {:#018x}) that overlaps an arena", base, base + size);
+        }
+
+        auto segment = _create_segment(base, size);
+        segment->lower = lower;
+        segment->higher = higher;
+        if (lower)
+        {
+            lower->higher = segment;
+        }
+        if (higher)
+        {
+            higher->lower = segment;
+        }
+
+        _segments.insert(std::unique_ptr<_segment>(segment));
+        _release(segment);
+    }
+
+    std::optional<std::uintptr_t> allocate(std::size_t size)
+    {
+        size = _round_up(size);
+        if (size == 0)
+        {
+            PANIC("tried to allocate an empty range from an arena");
+        }
+
+        auto quanta = size / _quantum;
+        auto exact_class = _class_of(quanta);
+
+        // every segment in the classes above the one of the size is large enough
+        auto first_class = (quanta & (quanta - 1)) ? exact_class + 1 : exact_class;
+        for (auto size_class = first_class; size_class < _class_count; ++size_class)
+        {
+            if (_free_lists[size_class])
+            {
+                return _allocate_from(_free_lists[size_class], size);
+            }
+        }
+
+        // the class of the size itself can still contain segments that are large enough
+        for (auto segment = _free_lists[exact_class]; segment; segment = segment->free_next)
+        {
+            if (segment->size >= size)
+            {
+                return _allocate_from(segment, size);
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // `size` must be the size the range was allocated with.
+    void free(std::uintptr_t base, std::size_t size)
+    {
+        size = _round_up(size);
+
+        auto it = _segments.find(base);
+        if (it == _segments.end() || it->is_free || it->size != size)
+        {
+            PANIC("tried to free a range ({:#018x}, {:#018x}) that isn't allocated", base, base + size);
+        }
+
+        _release(&*it);
+    }
+
+private:
+    struct _segment : treeable<_segment>
+    {
+        std::uintptr_t base = 0;
+        std::size_t size = 0;
+        bool is_free = false;
+
+        // the neighbouring segments in address order
+        _segment * lower = nullptr;
+        _segment * higher = nullptr;
+
+        // the free list of the size class, while the segment is free
+        _segment * free_prev = nullptr;
+        _segment * free_next = nullptr;
+    };
+
+    struct _base_compare
+    {
+        bool operator()(const _segment & lhs, const _segment & rhs) const
+        {
+            return lhs.base < rhs.base;
+        }
+
+        bool operator()(std::uintptr_t lhs, const _segment & rhs) const
+        {
+            return lhs < rhs.base;
+        }
+
+        bool operator()(const _segment & lhs, std::uintptr_t rhs) const
+        {
+            return lhs.base < rhs;
+        }
+    };
+
+    static constexpr std::size_t _class_count = 64;
+    static constexpr std::size_t _bootstrap_count = 4;
+
+    // The first few segments don't come from the chained allocator, and so from the PMM, so that an arena can
+    // hand out ranges before the PMM is initialized. They end up in the chained allocator once freed.
+    alignas(_segment) static inline unsigned char _bootstrap[_bootstrap_count * sizeof(_segment)];
+    static inline std::atomic<std::size_t> _bootstrap_used = 0;
+
+    static _segment * _create_segment(std::uintptr_t base, std::size_t size)
+    {
+        _segment * segment;
+
+        auto index = _bootstrap_used.load(std::memory_order_relaxed);
+        if (index < _bootstrap_count && _bootstrap_used.compare_exchange_strong(index, index + 1))
+        {
+            segment = ::new (_bootstrap + index * sizeof(_segment)) _segment();
+        }
+        else
+        {
+            segment = new _segment();
+        }
+
+        segment->base = base;
+        segment->size = size;
+        return segment;
+    }
+
+    static std::size_t _class_of(std::size_t quanta)
+    {
+        return 63 - __builtin_clzll(quanta);
+    }
+
+    std::size_t _round_up(std::size_t size) const
+    {
+        return (size + _quantum - 1) / _quantum * _quantum;
+    }
+
+    void _link_free(_segment * segment)
+    {
+        auto & head = _free_lists[_class_of(segment->size / _quantum)];
+
+        segment->is_free = true;
+        segment->free_prev = nullptr;
+        segment->free_next = head;
+        if (head)
+        {
+            head->free_prev = segment;
+        }
+        head = segment;
+    }
+
+    void _unlink_free(_segment * segment)
+    {
+        if (segment->free_prev)
+        {
+            segment->free_prev->free_next = segment->free_next;
+        }
+        else
+        {
+            _free_lists[_class_of(segment->size / _quantum)] = segment->free_next;
+        }
+
+        if (segment->free_next)
+        {
+            segment->free_next->free_prev = segment->free_prev;
+        }
+
+        segment->is_free = false;
+    }
+
+    // Drops a segment that has been merged into its lower neighbour.
+    void _remove(_segment * segment)
+    {
+        segment->lower->higher = segment->higher;
+        if (segment->higher)
+        {
+            segment->higher->lower = segment->lower;
+        }
+
+        _segments.erase(segment);
+    }
+
+    std::uintptr_t _allocate_from(_segment * segment, std::size_t size)
+    {
+        _unlink_free(segment);
+        _free_size -= size;
+
+        if (segment->size == size)
+        {
+            return segment->base;
+        }
+
+        // the allocation is carved from the top of the segment, so that the remainder keeps its base, and
+        // with it its place in the tree
+        segment->size -= size;
+        _link_free(segment);
+
+        auto allocated = _create_segment(segment->base + segment->size, size);
+        allocated->lower = segment;
+        allocated->higher = segment->higher;
+        if (segment->higher)
+        {
+            segment->higher->lower = allocated;
+        }
+        segment->higher = allocated;
+
+        _segments.insert(std::unique_ptr<_segment>(allocated));
+        return allocated->base;
+    }
+
+    // Returns a segment that isn't on a free list to the free lists, merged with its free neighbours.
+    void _release(_segment * segment)
+    {
+        _free_size += segment->size;
+
+        auto higher = segment->higher;
+        if (higher && higher->is_free && segment->base + segment->size == higher->base)
+        {
+            _unlink_free(higher);
+            segment->size += higher->size;
+            _remove(higher);
+        }
+
+        auto lower = segment->lower;
+        if (lower && lower->is_free && lower->base + lower->size == segment->base)
+        {
+            _unlink_free(lower);
+            lower->size += segment->size;
+            _remove(segment);
+            segment = lower;
+        }
+
+        _link_free(segment);
+    }
+
+    std::size_t _quantum;
+    std::size_t _free_size = 0;
+    _segment * _free_lists[_class_count] = {};
+    avl_tree<_segment, _base_compare> _segments;
+};
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -22,7 +22,21 @@
 
 namespace kernel::util
 {
-template<typename T, typename Comparator, template<typename> typename UnboundTraits = unique_ptr_traits>
+struct no_augmentation
+{
+    template<typename T>
+    void operator()(T &, T *, T *) const
+    {
+    }
+};
+
+// `Augmentation` is called as `augmentation(element, left, right)` on every element whose subtree changes,
+// after its children have been updated, to recompute data kept in elements about their subtrees.
+template<
+    typename T,
+    typename Comparator,
+    template<typename> typename UnboundTraits = unique_ptr_traits,
+    typename Augmentation = no_augmentation>
 class avl_tree
 {
     using Traits = UnboundTraits<T>;
@@ -97,7 +111,7 @@ public:
     class iterator
     {
     public:
-        friend class avl_tree<T, Comparator, UnboundTraits>;
+        friend class avl_tree<T, Comparator, UnboundTraits, Augmentation>;
 
         using difference_type = std::ptrdiff_t;
         using value_type = T;
@@ -203,12 +217,11 @@ public:
             auto old_root = _root;
             _root = old_root->get_right();
 
-            if (!_root)
+            if (_root)
             {
-                return;
+                _root->set_tree_parent(nullptr);
             }
 
-            _root->set_tree_parent(nullptr);
             (void)Traits::create(old_root->unwrap());
         }
     }
@@ -238,6 +251,7 @@ public:
         if (!_root)
         {
             _root = _tree_element::wrap(Traits::unwrap(std::move(element_ptr)));
+            _update(_root);
             ++_size;
             return std::make_pair(iterator{ _root }, true);
         }
@@ -279,6 +293,7 @@ public:
         }
 
         _insert_rebalance(current);
+        _update_path(current);
         ++_size;
         return std::make_pair(iterator{ current }, true);
     }
@@ -368,13 +383,7 @@ public:
                 next->set_tree_parent(wrapped->get_tree_parent());
                 if (!next->get_tree_parent())
                 {
-                    next->set_balance_factor(wrapped->get_balance_factor() - 1);
                     _root = next;
-                    if (wrapped->get_balance_factor() < 0)
-                    {
-                        _rebalance_right(next);
-                    }
-                    shortened_base = nullptr;
                 }
             }
             else
@@ -423,6 +432,7 @@ public:
         if (shortened_base)
         {
             _erase_rebalance(shortened_base, shortened_left);
+            _update_path(shortened_base);
         }
 
         Traits::create(element_ptr);
@@ -485,53 +495,47 @@ public:
     template<typename Key>
     iterator lower_bound(const Key & value)
     {
-        if (!_root)
-        {
-            return end();
-        }
-
+        // the smallest element seen so far that is not less than the value
+        _tree_element * candidate = nullptr;
         auto current = _root;
 
-        while (true)
+        while (current)
         {
-            auto less = _comp(value, *current->unwrap());
-            auto greater = _comp(*current->unwrap(), value);
-
-            if (!less && !greater)
+            if (_comp(*current->unwrap(), value))
             {
-                return iterator{ current };
+                current = current->get_right();
             }
-
-            if (less)
+            else
             {
-                if (!current->get_left())
-                {
-                    return iterator{ current };
-                }
-
+                candidate = current;
                 current = current->get_left();
-                continue;
             }
+        }
 
-            if (!current->get_right())
-            {
-                if (!current->get_tree_parent())
-                {
-                    return end();
-                }
-
-                if (current->get_tree_parent()->get_right() == current)
-                {
-                    return end();
-                }
+        return iterator{ candidate };
+    }
 
-                current = current->get_tree_parent();
+    // returns the last element that is not greater than the value, or end() if there is no such element
+    template<typename Key>
+    iterator floor(const Key & value)
+    {
+        _tree_element * candidate = nullptr;
+        auto current = _root;
 
-                return iterator{ current };
+        while (current)
+        {
+            if (_comp(value, *current->unwrap()))
+            {
+                current = current->get_left();
+            }
+            else
+            {
+                candidate = current;
+                current = current->get_right();
             }
-
-            current = current->get_right();
         }
+
+        return iterator{ candidate };
     }
 
     template<typename Key>
@@ -558,6 +562,24 @@ public:
         return _size;
     }
 
+    // For searches that descend the tree on their own, e.g. to make use of augmented data.
+    T * root() const
+    {
+        return _root ? _root->unwrap() : nullptr;
+    }
+
+    static T * left_child(T * element)
+    {
+        auto left = _tree_element::wrap(element)->get_left();
+        return left ? left->unwrap() : nullptr;
+    }
+
+    static T * right_child(T * element)
+    {
+        auto right = _tree_element::wrap(element)->get_right();
+        return right ? right->unwrap() : nullptr;
+    }
+
     struct invariant_check_result
     {
         bool correct;
@@ -574,6 +596,23 @@ public:
     }
 
 private:
+    void _update(_tree_element * node)
+    {
+        auto left = node->get_left();
+        auto right = node->get_right();
+        _augmentation(*node->unwrap(), left ? left->unwrap() : nullptr, right ? right->unwrap() : nullptr);
+    }
+
+    // Recomputes the augmented data from `node` up to the root. Rebalancing only leaves stale data in the
+    // ancestors of the element that was inserted or removed; the elements it rotates are updated right away.
+    void _update_path(_tree_element * node)
+    {
+        for (; node; node = node->get_tree_parent())
+        {
+            _update(node);
+        }
+    }
+
     void _insert_rebalance(_tree_element * current)
     {
         for (auto parent = current->get_tree_parent(); parent; parent = current->get_tree_parent())
@@ -734,6 +773,9 @@ private:
         right->set_left(node);
         right->set_tree_parent(parent);
 
+        _update(node);
+        _update(right);
+
         if (parent)
         {
             if (parent->get_left() == node)
@@ -769,6 +811,9 @@ private:
         left->set_right(node);
         left->set_tree_parent(parent);
 
+        _update(node);
+        _update(left);
+
         if (parent)
         {
             if (parent->get_left() == node)
@@ -983,5 +1028,6 @@ private:
     _tree_element * _root = nullptr;
     std::size_t _size = 0;
     Comparator _comp;
+    [[no_unique_address]] Augmentation _augmentation;
 };
 }
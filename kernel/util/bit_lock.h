@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include "mp.h"
+
 #include <cstdint>
 
 // TODO: rewrite as atomic_ref?
@@ -34,6 +36,8 @@ public:
         while (__atomic_fetch_or(_address, static_cast<std::uint64_t>(1) << Bit, __ATOMIC_ACQ_REL)
                & (static_cast<std::uint64_t>(1) << Bit))
         {
+            // the holder may be waiting for a TLB shootdown to reach this core
+            mp::handle_pending_ipis();
             asm volatile("pause" ::: "memory");
         }
     }
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -113,6 +113,9 @@ namespace
 
             case policy::specific:
                 return target == core;
+
+            case policy::mask:
+                return reinterpret_cast<const core_mask *>(target)->contains(core);
         }
     }
 }
@@ -146,6 +149,12 @@ void erased_parallel_execute(
                 auto & item = outgoing_ipi_items[self_id * core_count + i];
                 item.state = &state;
                 arch::cpu::get_core_by_id(i)->get_ipi_queue()->push(&item);
+
+                // the current core drains its own queue below
+                if (pol == policy::mask && i != self_id)
+                {
+                    arch::ipi::ipi(i, arch::irq::ipi_trigger);
+                }
             }
         }
     }
@@ -159,6 +168,9 @@ void erased_parallel_execute(
         case policy::specific:
             arch::ipi::ipi(target, arch::irq::ipi_trigger);
             break;
+
+        case policy::mask:
+            break;
     }
 
     while (state.unfinished_cores != 0)
@@ -167,6 +179,16 @@ void erased_parallel_execute(
     }
 }
 
+void handle_pending_ipis()
+{
+    if (!outgoing_ipi_items)
+    {
+        return;
+    }
+
+    arch::cpu::get_core_local_storage()->current_core->get_ipi_queue()->drain();
+}
+
 void parallel_execute(policy pol, void (*fptr)(), std::uintptr_t target)
 {
     erased_parallel_execute(
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2021-2022 Michał 'Griwes' Dominiak
+ * Copyright © 2021-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,9 +16,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <mutex>
+#include <shared_mutex>
 #include <type_traits>
 
 namespace kernel::mp
@@ -37,10 +40,37 @@ private:
     ipi_queue_item * _tail = nullptr;
 };
 
+// A set of cores, identified by their IDs, that can be changed and read concurrently.
+class core_mask
+{
+public:
+    static constexpr std::size_t max_cores = 1024;
+
+    void set(std::size_t core)
+    {
+        _words[core / 64].fetch_or(1ull << (core % 64));
+    }
+
+    void clear(std::size_t core)
+    {
+        _words[core / 64].fetch_and(~(1ull << (core % 64)));
+    }
+
+    bool contains(std::size_t core) const
+    {
+        return _words[core / 64].load() & (1ull << (core % 64));
+    }
+
+private:
+    std::atomic<std::uint64_t> _words[max_cores / 64]{};
+};
+
 enum class policy
 {
     all,
     specific,
+    // the cores in the core_mask pointed to by the target, as of when each of them is considered
+    mask,
     // TODO:
     // others,
     // all_domain,
@@ -97,4 +127,82 @@ requires(std::is_trivially_copyable_v<Context> && sizeof(Context) <= 8) void par
 {
     return parallel_execute(policy::all, fptr, ctx, target);
 }
+
+// Handles the requests of parallel_execute queued for the current core, without waiting for the IPI.
+// Anything that spins with interrupts disabled, waiting for another core that may be in a parallel_execute
+// itself (like the holder of a lock that issues TLB shootdowns), must call this while spinning; otherwise,
+// the two cores wait for each other forever. Does nothing before parallel execution is initialized.
+void handle_pending_ipis();
+
+// Locks that are held across parallel_execute; waiting for them handles the IPIs sent to the current core.
+class ipi_handling_mutex
+{
+public:
+    void lock()
+    {
+        while (!_mutex.try_lock())
+        {
+            handle_pending_ipis();
+            asm volatile("pause" ::: "memory");
+        }
+    }
+
+    bool try_lock()
+    {
+        return _mutex.try_lock();
+    }
+
+    void unlock()
+    {
+        _mutex.unlock();
+    }
+
+private:
+    std::mutex _mutex;
+};
+
+class ipi_handling_shared_mutex
+{
+public:
+    void lock()
+    {
+        while (!_mutex.try_lock())
+        {
+            handle_pending_ipis();
+            asm volatile("pause" ::: "memory");
+        }
+    }
+
+    bool try_lock()
+    {
+        return _mutex.try_lock();
+    }
+
+    void unlock()
+    {
+        _mutex.unlock();
+    }
+
+    void lock_shared()
+    {
+        while (!_mutex.try_lock_shared())
+        {
+            handle_pending_ipis();
+            asm volatile("pause" ::: "memory");
+        }
+    }
+
+    bool try_lock_shared()
+    {
+        return _mutex.try_lock_shared();
+    }
+
+    void unlock_shared()
+    {
+        _mutex.unlock_shared();
+    }
+
+private:
+    std::shared_mutex _mutex;
+};
 }
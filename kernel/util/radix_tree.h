@@ -0,0 +1,307 @@
+/*
+ * Copyright © 2026 Michał 'Griwes' Dominiak
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "../memory/pmm.h"
+#include "log.h"
+
+#include <optional>
+
+namespace kernel::util
+{
+// Maps indices below a fixed capacity to values. Like the page tables, every node takes up a single frame and
+// resolves 9 bits of the index; nodes are only allocated once something is stored below them, so a densely
+// populated tree costs just over a machine word per index, and a lookup is a fixed number of steps.
+// Values must have their lowest bit clear (which holds for addresses of frames), as it marks present slots.
+class radix_tree
+{
+public:
+    static constexpr std::size_t bits_per_level = 9;
+    static constexpr std::size_t fanout = static_cast<std::size_t>(1) << bits_per_level;
+
+    radix_tree(std::size_t capacity) : _capacity(capacity)
+    {
+        for (std::size_t reach = fanout; reach < capacity; reach *= fanout)
+        {
+            ++_height;
+        }
+    }
+
+    radix_tree(const radix_tree &) = delete;
+    radix_tree & operator=(const radix_tree &) = delete;
+
+    ~radix_tree()
+    {
+        _free(_root, _height);
+    }
+
+    std::size_t capacity() const
+    {
+        return _capacity;
+    }
+
+    std::optional<std::uintptr_t> find(std::size_t index) const
+    {
+        if (index >= _capacity)
+        {
+            return std::nullopt;
+        }
+
+        auto slot = _root;
+        for (auto height = _height; height != 0; --height)
+        {
+            if (!slot)
+            {
+                return std::nullopt;
+            }
+
+            slot = reinterpret_cast<const _node *>(slot)->slots[_slot_index(index, height)];
+        }
+
+        if (!(slot & _present))
+        {
+            return std::nullopt;
+        }
+
+        return slot & ~_present;
+    }
+
+    void insert(std::size_t index, std::uintptr_t value)
+    {
+        if (index >= _capacity)
+        {
+            PANIC("tried to insert index {} into a radix tree of capacity {}", index, _capacity);
+        }
+
+        _for_each_slot<true>(
+            _root,
+            _height,
+            0,
+            index,
+            index + 1,
+            [&](std::size_t, std::uintptr_t & slot) { slot = _wrap(value); });
+    }
+
+    // Counts the indices in [begin, end) that have a value; subtrees that were never populated are skipped
+    // without being visited.
+    std::size_t count(std::size_t begin, std::size_t end) const
+    {
+        std::size_t ret = 0;
+        for_each(begin, end, [&](std::size_t, std::uintptr_t) { ++ret; });
+        return ret;
+    }
+
+    // Stores `make_value(index)` at every index in [begin, end) that doesn't have a value yet.
+    template<typename F>
+    void fill(std::size_t begin, std::size_t end, F && make_value)
+    {
+        end = end < _capacity ? end : _capacity;
+        if (begin >= end)
+        {
+            return;
+        }
+
+        _for_each_slot<true>(
+            _root,
+            _height,
+            0,
+            begin,
+            end,
+            [&](std::size_t index, std::uintptr_t & slot)
+            {
+                if (!(slot & _present))
+                {
+                    slot = _wrap(make_value(index));
+                }
+            });
+    }
+
+    // Replaces the value at every index in [begin, end) that has one with `f(index, value)`.
+    template<typename F>
+    void transform(std::size_t begin, std::size_t end, F && f)
+    {
+        end = end < _capacity ? end : _capacity;
+        if (begin >= end)
+        {
+            return;
+        }
+
+        _for_each_slot<false>(
+            _root,
+            _height,
+            0,
+            begin,
+            end,
+            [&](std::size_t index, std::uintptr_t & slot)
+            {
+                if (slot & _present)
+                {
+                    slot = _wrap(f(index, slot & ~_present));
+                }
+            });
+    }
+
+    // Removes the values at all indices in [begin, end). Nodes are kept around until the tree is destroyed.
+    void erase(std::size_t begin, std::size_t end)
+    {
+        end = end < _capacity ? end : _capacity;
+        if (begin >= end)
+        {
+            return;
+        }
+
+        _for_each_slot<false>(
+            _root, _height, 0, begin, end, [&](std::size_t, std::uintptr_t & slot) { slot = 0; });
+    }
+
+    // Calls `f(index, value)` for every index in [begin, end) that has a value, in increasing order.
+    template<typename F>
+    void for_each(std::size_t begin, std::size_t end, F && f) const
+    {
+        end = end < _capacity ? end : _capacity;
+        if (begin >= end)
+        {
+            return;
+        }
+
+        // nothing is written when nodes aren't created
+        const_cast<radix_tree *>(this)->_for_each_slot<false>(
+            const_cast<radix_tree *>(this)->_root,
+            _height,
+            0,
+            begin,
+            end,
+            [&](std::size_t index, std::uintptr_t slot)
+            {
+                if (slot & _present)
+                {
+                    f(index, slot & ~_present);
+                }
+            });
+    }
+
+    template<typename F>
+    void for_each(F && f) const
+    {
+        for_each(0, _capacity, f);
+    }
+
+private:
+    struct _node
+    {
+        std::uintptr_t slots[fanout]{};
+
+        static void * operator new(std::size_t)
+        {
+#ifndef REAVEROS_TESTING
+            return phys_ptr_t<_node>(pmm::pop(0)).value();
+#else
+            return malloc(sizeof(_node));
+#endif
+        }
+
+        static void operator delete(void * ptr, std::size_t)
+        {
+#ifndef REAVEROS_TESTING
+            pmm::push(0, phys_ptr_t(static_cast<_node *>(ptr)).representation());
+#else
+            free(ptr);
+#endif
+        }
+    };
+
+    static_assert(sizeof(_node) == arch::vm::page_sizes[0], "radix tree nodes must take up exactly a frame");
+
+    static constexpr std::uintptr_t _present = 1;
+
+    static std::uintptr_t _wrap(std::uintptr_t value)
+    {
+        if (value & _present)
+        {
+            PANIC("tried to store a value with the lowest bit set in a radix tree: {:#018x}", value);
+        }
+
+        return value | _present;
+    }
+
+    static std::size_t _slot_index(std::size_t index, std::size_t height)
+    {
+        return (index >> ((height - 1) * bits_per_level)) % fanout;
+    }
+
+    static void _free(std::uintptr_t slot, std::size_t height)
+    {
+        if (height == 0 || !slot)
+        {
+            return;
+        }
+
+        auto node = reinterpret_cast<_node *>(slot);
+        if (height > 1)
+        {
+            for (auto child : node->slots)
+            {
+                _free(child, height - 1);
+            }
+        }
+
+        delete node;
+    }
+
+    // Calls `f(index, slot)` for every leaf slot in [begin, end) of the subtree rooted in `slot`, which
+    // covers the indices starting at `base`. Missing nodes are created if `Create` is true, and skipped
+    // otherwise.
+    template<bool Create, typename F>
+    void _for_each_slot(
+        std::uintptr_t & slot,
+        std::size_t height,
+        std::size_t base,
+        std::size_t begin,
+        std::size_t end,
+        F && f)
+    {
+        if (height == 0)
+        {
+            f(base, slot);
+            return;
+        }
+
+        if (!slot)
+        {
+            if constexpr (!Create)
+            {
+                return;
+            }
+
+            slot = reinterpret_cast<std::uintptr_t>(new _node);
+        }
+
+        auto node = reinterpret_cast<_node *>(slot);
+        auto child_reach = static_cast<std::size_t>(1) << ((height - 1) * bits_per_level);
+
+        auto i = begin > base ? (begin - base) / child_reach : 0;
+        for (; i < fanout && base + i * child_reach < end; ++i)
+        {
+            _for_each_slot<Create>(node->slots[i], height - 1, base + i * child_reach, begin, end, f);
+        }
+    }
+
+    std::size_t _capacity;
+    std::size_t _height = 1;
+    std::uintptr_t _root = 0;
+};
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -181,9 +181,11 @@ void context::_insert_enum(std::string_view module, const parser::parsed_enum &
     s.module = module;
 
     generator::enum_description desc;
+    desc.is_flags = ast.is_flags;
     for (std::uintptr_t i = 0; i < ast.enumerations.size(); ++i)
     {
-        desc.enumerations.push_back(std::make_pair(std::move(ast.enumerations[i]), i));
+        desc.enumerations.push_back(
+            std::make_pair(std::move(ast.enumerations[i]), ast.is_flags ? std::uintptr_t(1) << i : i));
     }
 
     s.description = std::move(desc);
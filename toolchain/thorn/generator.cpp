@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -155,12 +155,31 @@ void context::generate_symbol(std::string_view name, const symbol & symb)
 
             user_stream << "enum class " << name << " : std::uintptr_t\n";
             user_stream << "{\n";
+            if (enum_.is_flags)
+            {
+                user_stream << "    none = 0,\n";
+            }
             for (auto && [name, value] : enum_.enumerations)
             {
                 user_stream << "    " << name << " = " << value << ",\n";
             }
             user_stream << "};\n" << std::endl;
 
+            if (enum_.is_flags)
+            {
+                user_stream << "inline " << name << " operator|(" << name << " lhs, " << name << " rhs)\n";
+                user_stream << "{\n";
+                user_stream << "    return static_cast<" << name
+                            << ">(std::to_underlying(lhs) | std::to_underlying(rhs));\n";
+                user_stream << "}\n\n";
+
+                user_stream << "inline " << name << " operator&(" << name << " lhs, " << name << " rhs)\n";
+                user_stream << "{\n";
+                user_stream << "    return static_cast<" << name
+                            << ">(std::to_underlying(lhs) & std::to_underlying(rhs));\n";
+                user_stream << "}\n" << std::endl;
+            }
+
             break;
         }
 
@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -37,6 +37,7 @@ struct permission_description
 struct enum_description
 {
     std::vector<std::pair<std::string, std::uintptr_t>> enumerations;
+    bool is_flags = false;
 };
 
 struct union_description
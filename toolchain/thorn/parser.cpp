@@ -1,5 +1,5 @@
 /*
- * Copyright © 2022 Michał 'Griwes' Dominiak
+ * Copyright © 2022-2026 Michał 'Griwes' Dominiak
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -180,6 +180,22 @@ parsed_enum parse_enum(std::string_view filename, lexer::tokenizer_iterator & it
     parsed_enum ret;
 
     expect(filename, it, lexer::token_type::enum_);
+
+    if (it->type == lexer::token_type::open_paren)
+    {
+        expect(filename, it, lexer::token_type::open_paren);
+        auto line = it->line;
+        auto column = it->column;
+        auto kind = expect(filename, it, lexer::token_type::identifier);
+        if (kind != "flags")
+        {
+            REPORT_ERROR(filename, line, column, "expected 'flags', got '" << kind << "'");
+        }
+        expect(filename, it, lexer::token_type::close_paren);
+
+        ret.is_flags = true;
+    }
+
     ret.name = expect(filename, it, lexer::token_type::identifier);
 
     expect(filename, it, lexer::token_type::open_paren);